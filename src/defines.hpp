@@ -5,20 +5,18 @@
 #include <fstream>
 #include "nodeid.hpp"
 
-extern std::atomic_int completed_flows;
-extern std::atomic_uint64_t total_frames_recvd;
-extern std::atomic_int *active_flows_with_dest;
-extern std::ofstream fct_csv;
+class ResultWriter;
+extern ResultWriter packet_trace;
 
 #define LINKS_PER_PHASE (NODES_PER_PHASE - 1)
 #define EPOCH_LENGTH (LINKS_PER_PHASE * NUM_PHASES)
 
-#define MAX_PHASES 4
 #define TOKENS_PER_PACKET 2
 
 extern int NUM_PHASES;
 extern int NODES_PER_PHASE;
 extern int PROP_DELAY_TS;
+extern int LOOKAHEAD_TS; //maximum number of ticks the workers run between synchronizations
 extern const BucketID INVALID_BUCKET;
 extern BucketID DIRECT_TO_DEST_BUCKET;
 
@@ -43,8 +41,19 @@ extern int RD_MAX_QUEUE_LENGTH;
 
 extern double TOTAL_FSR;
 
+extern double TRACE_SAMPLE_RATE;
+
 extern bool *is_failed_node;
 
+//Per-node activity, kept in one contiguous array so that the workers can find the nodes with something to do
+//without touching the others.
+typedef struct {
+   int wake_tick;           //earliest tick at which the node has something to send (INT_MAX if never)
+   std::atomic_int inbound; //non-empty frames, RDC messages and tokens on their way to the node
+} NodeActivity;
+
+extern NodeActivity *node_activity;
+
 #define MAX_FLOW_CREDIT 4.0
 
 #endif
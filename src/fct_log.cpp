@@ -0,0 +1,119 @@
+#include "fct_log.hpp"
+#include "result_writer.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+
+FctLog::~FctLog () {
+   if (!spill) return;
+   stop_writer();
+   std::fclose(spill);
+   spill = NULL;
+   std::filesystem::remove(spill_path);
+}
+
+void FctLog::open (const std::filesystem::path &path) {
+   spill_path = path;
+   spill = std::fopen(spill_path.c_str(), "wb");
+   if (!spill) {
+      std::cerr << "Error: could not open file " << spill_path << " for writing" << std::endl;
+      exit(EXIT_FAILURE);
+   }
+   stopping = false;
+   write_failed = false;
+   writer = std::thread(&FctLog::write_blocks, this);
+}
+
+FctLog::Shard *FctLog::attach_thread () {
+   std::lock_guard<std::mutex> lock(mutex);
+   shards.push_back(std::make_unique<Shard>());
+   local_shard = shards.back().get();
+   local_shard->block.reserve(BLOCK_SIZE);
+   return local_shard;
+}
+
+//Swaps the full block for an empty one, so the appending thread can carry on at once.
+void FctLog::hand_off (Block &block) {
+   Block replacement;
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      full_blocks.push_back(std::move(block));
+      if (!empty_blocks.empty()) {
+         replacement = std::move(empty_blocks.back());
+         empty_blocks.pop_back();
+      }
+   }
+   blocks_ready.notify_one();
+   replacement.reserve(BLOCK_SIZE);
+   block = std::move(replacement);
+}
+
+void FctLog::write_blocks () {
+   std::unique_lock<std::mutex> lock(mutex);
+   while (true) {
+      blocks_ready.wait(lock, [this]{ return stopping || !full_blocks.empty(); });
+      if (full_blocks.empty()) return;
+      std::vector<Block> blocks;
+      blocks.swap(full_blocks);
+      lock.unlock();
+      bool failed = false;
+      for (Block &block : blocks) {
+         if (std::fwrite(block.data(), sizeof(FctRecord), block.size(), spill) != block.size()) failed = true;
+         block.clear();
+      }
+      lock.lock();
+      write_failed |= failed;
+      for (Block &block : blocks) {
+         empty_blocks.push_back(std::move(block));
+      }
+   }
+}
+
+void FctLog::stop_writer () {
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+   }
+   blocks_ready.notify_one();
+   writer.join();
+}
+
+void FctLog::close (const std::filesystem::path &csv_path) {
+   if (!spill) return;
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto &shard : shards) {
+         if (!shard->block.empty()) full_blocks.push_back(std::move(shard->block));
+      }
+   }
+   stop_writer();
+   bool closed = std::fclose(spill) == 0;
+   spill = NULL;
+   if (write_failed || !closed) {
+      std::cerr << "Error: could not write " << spill_path << std::endl;
+      std::filesystem::remove(spill_path);
+      exit(EXIT_FAILURE);
+   }
+
+   std::vector<FctRecord> records(std::filesystem::file_size(spill_path) / sizeof(FctRecord));
+   std::FILE *in = std::fopen(spill_path.c_str(), "rb");
+   if (!in || std::fread(records.data(), sizeof(FctRecord), records.size(), in) != records.size()) {
+      std::cerr << "Error: could not read back " << spill_path << std::endl;
+      exit(EXIT_FAILURE);
+   }
+   std::fclose(in);
+
+   std::sort(records.begin(), records.end(), [](const FctRecord &a, const FctRecord &b) {
+      long a_end = (long)a.start_tick + a.duration;
+      long b_end = (long)b.start_tick + b.duration;
+      return a_end != b_end ? a_end < b_end : a.flow_id < b.flow_id;
+   });
+
+   ResultWriter table;
+   table.open(csv_path, {{"flow_id", false}, {"num_frames", false}, {"duration", false}, {"start_tick", false}});
+   for (const FctRecord &record : records) {
+      table.row({record.flow_id, record.num_frames, record.duration, record.start_tick});
+   }
+   table.close();
+   std::filesystem::remove(spill_path);
+}
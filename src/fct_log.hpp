@@ -0,0 +1,78 @@
+#ifndef __FCT_LOG_H
+#define __FCT_LOG_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//A completed flow: one line of fct.csv.
+typedef struct {
+   int flow_id;
+   int num_frames;
+   int duration;
+   int start_tick;
+} FctRecord;
+
+//Collects the completed flows without any locking on the receive path.
+//Each thread appends fixed-size binary records to its own block. Full blocks are handed to a background thread,
+//which appends them to a spill file in the output directory. When the run is over, close() reads the spill file
+//back and writes fct.csv (or its binary table, see ResultWriter) sorted by completion tick, then by flow ID, so the
+//file is the same whatever the number of threads.
+class FctLog {
+   static const int BLOCK_SIZE = 4096; //records
+
+   typedef std::vector<FctRecord> Block;
+
+   struct alignas(64) Shard {
+      Block block;
+   };
+
+   std::mutex mutex;
+   std::condition_variable blocks_ready;
+   std::vector<std::unique_ptr<Shard>> shards;
+   std::vector<Block> full_blocks;
+   std::vector<Block> empty_blocks;
+   bool stopping = false;
+   std::thread writer;
+   std::FILE *spill = NULL;
+   std::filesystem::path spill_path;
+   bool write_failed = false;
+
+   static inline thread_local Shard *local_shard = NULL;
+
+   public:
+   //If the log is still open, the run was cut short (by exit() on an error): stops the writer and removes the spill
+   //file, which is of no use without the rest of the run.
+   ~FctLog ();
+
+   bool is_open () const { return spill != NULL; }
+
+   //Starts collecting records, spilling them to spill_path. Exits if the file cannot be created.
+   void open (const std::filesystem::path &spill_path);
+
+   //Must only be called while the log is open.
+   void append (const FctRecord &record) {
+      Shard *shard = local_shard;
+      if (!shard) shard = attach_thread();
+      shard->block.push_back(record);
+      if (shard->block.size() == BLOCK_SIZE) hand_off(shard->block);
+   }
+
+   //Once no thread appends any more: writes every record to the table for csv_path and removes the spill file.
+   //Exits with an error message if the spill file could not be written.
+   void close (const std::filesystem::path &csv_path);
+
+   private:
+   Shard *attach_thread ();
+   void hand_off (Block &block);
+   void write_blocks ();
+   void stop_writer ();
+};
+
+extern FctLog fct_log;
+
+#endif
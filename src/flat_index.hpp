@@ -0,0 +1,100 @@
+#ifndef __FLAT_INDEX_H
+#define __FLAT_INDEX_H
+
+#include <vector>
+
+//Open-addressing hash index from non-negative int keys to int values (typically slots in a pool of objects).
+//Uses linear probing with backward-shift deletion, so lookups never have to step over tombstones.
+//The table is kept at most half full.
+class FlatIndex {
+   typedef struct {
+      int key;
+      int value;
+   } Entry;
+
+   std::vector<Entry> entries;
+   int mask;
+   int shift;
+   int num_keys;
+
+   public:
+   static const int NOT_FOUND = -1;
+
+   FlatIndex () {
+      rehash(8);
+   }
+
+   int size () const { return num_keys; }
+
+   //Value stored for key, or NOT_FOUND.
+   int find (int key) const {
+      for (int i = home(key); ; i = (i + 1) & mask) {
+         if (entries[i].key == key) return entries[i].value;
+         if (entries[i].key == EMPTY) return NOT_FOUND;
+      }
+   }
+
+   //Value stored for key. If there is none, new_value is stored first and inserted is set.
+   //The reference is only valid until the next insertion.
+   int &find_or_insert (int key, int new_value, bool &inserted) {
+      int i = home(key);
+      for (; entries[i].key != EMPTY; i = (i + 1) & mask) {
+         if (entries[i].key == key) {
+            inserted = false;
+            return entries[i].value;
+         }
+      }
+      inserted = true;
+      if (2 * (num_keys + 1) > (int)entries.size()) {
+         rehash(2 * entries.size());
+         for (i = home(key); entries[i].key != EMPTY; i = (i + 1) & mask);
+      }
+      entries[i] = {key, new_value};
+      num_keys++;
+      return entries[i].value;
+   }
+
+   //Removes key and returns the value that was stored for it, or NOT_FOUND.
+   int erase (int key) {
+      int i = home(key);
+      for (; entries[i].key != key; i = (i + 1) & mask) {
+         if (entries[i].key == EMPTY) return NOT_FOUND;
+      }
+      int value = entries[i].value;
+
+      //Move later entries of the probe sequence into the hole, unless that would put them before their home slot.
+      for (int j = (i + 1) & mask; entries[j].key != EMPTY; j = (j + 1) & mask) {
+         if (((j - home(entries[j].key)) & mask) >= ((j - i) & mask)) {
+            entries[i] = entries[j];
+            i = j;
+         }
+      }
+      entries[i].key = EMPTY;
+      num_keys--;
+      return value;
+   }
+
+   private:
+   static const int EMPTY = -1;
+
+   //Fibonacci hashing, so that runs of consecutive keys (e.g. neighbouring node IDs) spread over the table.
+   int home (int key) const {
+      return (int)(((unsigned int)key * 2654435769u) >> shift);
+   }
+
+   void rehash (int capacity) {
+      std::vector<Entry> old_entries(capacity, Entry{EMPTY, 0});
+      old_entries.swap(entries);
+      mask = capacity - 1;
+      shift = 32;
+      for (int c = capacity; c > 1; c /= 2) shift--;
+      num_keys = 0;
+      for (Entry &entry : old_entries) {
+         if (entry.key == EMPTY) continue;
+         bool inserted;
+         find_or_insert(entry.key, entry.value, inserted);
+      }
+   }
+};
+
+#endif
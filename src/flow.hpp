@@ -1,7 +1,9 @@
 #ifndef __FLOW_H
 #define __FLOW_H
 
+#include <vector>
 #include "nodeid.hpp"
+#include "flat_index.hpp"
 
 typedef struct {
    int flow_id;
@@ -11,8 +13,122 @@ typedef struct {
    int quantized_num_frames;
    int remain_frames;
    int start_tick;
+   int credit_entry; //active flow count of dest at or before the one in force at credit_tick + 1 (see Statistics)
    double credit;
+   int credit_tick; //last tick whose credit has been added, see Node::catch_up_flow_credit
    int budget;
 } Flow;
 
+//The flows a node is currently sending, in the order in which they started, with one round-robin cursor per link.
+//Flows live in dense slots and are found by flow ID through a FlatIndex. A finished flow leaves a tombstone in the
+//order, which is compacted away once tombstones outnumber live flows, so finishing a flow does not have to visit
+//every cursor. A cursor is either END or a position at or before some live flow, and it stands for the first live
+//flow at or after that position, just like an iterator into a list from which flows are erased.
+class SendingFlows {
+   std::vector<Flow> slots;
+   std::vector<int> free_slots;
+   FlatIndex slot_of_flow;
+   std::vector<int> order; //slots, or TOMBSTONE
+   int num_live = 0;
+   int last_live = -1;     //position of the last live flow in order
+   std::vector<int> cursors;
+
+   public:
+   static constexpr int END = -1;
+
+   void set_num_cursors (int num_cursors) {
+      cursors.assign(num_cursors, END);
+   }
+
+   int size () const { return num_live; }
+   bool empty () const { return num_live == 0; }
+
+   void start (const Flow &flow) {
+      int slot;
+      if (free_slots.empty()) {
+         slot = slots.size();
+         slots.push_back(flow);
+      } else {
+         slot = free_slots.back();
+         free_slots.pop_back();
+         slots[slot] = flow;
+      }
+      bool inserted;
+      slot_of_flow.find_or_insert(flow.flow_id, slot, inserted) = slot;
+      order.push_back(slot);
+      last_live = order.size() - 1;
+      num_live++;
+   }
+
+   //The flow, or NULL if it is not being sent.
+   Flow *find (int flow_id) {
+      int slot = slot_of_flow.find(flow_id);
+      return slot == FlatIndex::NOT_FOUND ? NULL : &slots[slot];
+   }
+
+   //Position of the flow that cursor stands for. A cursor at END wraps around to the first flow.
+   //Only call while there are flows.
+   int position (int cursor) const {
+      int position = cursors[cursor] == END ? 0 : cursors[cursor];
+      while (order[position] == TOMBSTONE) position++;
+      return position;
+   }
+
+   Flow &at (int position) { return slots[order[position]]; }
+
+   //Moves cursor past the flow at position.
+   void advance (int cursor, int position) {
+      cursors[cursor] = position < last_live ? position + 1 : END;
+   }
+
+   //Removes the flow at position and moves cursor past it. Other cursors on it move on by themselves.
+   void finish (int cursor, int position) {
+      int slot = order[position];
+      slot_of_flow.erase(slots[slot].flow_id);
+      free_slots.push_back(slot);
+      order[position] = TOMBSTONE;
+      num_live--;
+
+      if (position == last_live) {
+         do {
+            last_live--;
+         } while (last_live >= 0 && order[last_live] == TOMBSTONE);
+         //Cursors past the last flow are at the end, and must stay there when new flows are started.
+         for (int &other_cursor : cursors) {
+            if (other_cursor > last_live) other_cursor = END;
+         }
+      }
+      advance(cursor, position);
+
+      if ((int)order.size() - num_live > num_live) {
+         compact();
+      }
+   }
+
+   template <typename F>
+   void for_each (F &&f) {
+      for (int slot : order) {
+         if (slot != TOMBSTONE) f(slots[slot]);
+      }
+   }
+
+   private:
+   static constexpr int TOMBSTONE = -1;
+
+   void compact () {
+      //new position of the first live flow at or after each old position
+      std::vector<int> new_position(order.size() + 1);
+      int live = 0;
+      for (int position = 0; position < (int)order.size(); position++) {
+         new_position[position] = live;
+         if (order[position] != TOMBSTONE) order[live++] = order[position];
+      }
+      order.resize(live);
+      for (int &cursor : cursors) {
+         if (cursor != END) cursor = new_position[cursor];
+      }
+      last_live = live - 1;
+   }
+};
+
 #endif
@@ -0,0 +1,71 @@
+#ifndef __LINK_ARENA_H
+#define __LINK_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "defines.hpp"
+
+//One node's entries of a per-(phase, link) field, indexed as [phase][link].
+//The EPOCH_LENGTH entries of a node are contiguous, so scanning a phase's links (or all of them) streams through memory.
+template <typename T>
+class PerLink {
+   T *row;
+
+   public:
+   PerLink () : row(NULL) {}
+   explicit PerLink (T *row) : row(row) {}
+
+   T *operator[] (int phase) const { return row + phase * LINKS_PER_PHASE; }
+
+   T *begin () const { return row; }
+   T *end () const { return row + EPOCH_LENGTH; }
+};
+
+class Node;
+
+//Per-(phase, link) scalars of all nodes, carved out of a single allocation.
+//Each field is its own array of MAX_NODE_ID * EPOCH_LENGTH entries (structure of arrays), so that the fields the
+//stages touch every tick share cache lines only with each other, and not with the max-tracking statistics.
+class LinkArena {
+   std::unique_ptr<std::byte[]> storage;
+
+   public:
+   //Hot: read or written by the stages of every tick.
+   Node **adjacent_node;
+   NodeID *adjacent_id;
+   int *cur_enqueued_frames;
+   bool *link_failed;
+
+   //Cold: only written when a maximum is exceeded, and read when writing results.
+   int *max_enqueued_frames;
+   int *max_send_queue_length;
+
+   void allocate (int num_nodes) {
+      size_t entries = (size_t)num_nodes * EPOCH_LENGTH;
+      size_t offsets[6];
+      size_t size = 0;
+      size_t field_sizes[6] = {sizeof(Node *), sizeof(NodeID), sizeof(int), sizeof(bool), sizeof(int), sizeof(int)};
+      for (int f = 0; f < 6; f++) {
+         offsets[f] = size;
+         size += (entries * field_sizes[f] + 63) / 64 * 64;
+      }
+      storage.reset(new std::byte[size + 64]());
+      std::byte *base = storage.get() + (64 - (uintptr_t)storage.get() % 64) % 64;
+      adjacent_node = reinterpret_cast<Node **>(base + offsets[0]);
+      adjacent_id = reinterpret_cast<NodeID *>(base + offsets[1]);
+      cur_enqueued_frames = reinterpret_cast<int *>(base + offsets[2]);
+      link_failed = reinterpret_cast<bool *>(base + offsets[3]);
+      max_enqueued_frames = reinterpret_cast<int *>(base + offsets[4]);
+      max_send_queue_length = reinterpret_cast<int *>(base + offsets[5]);
+   }
+
+   template <typename T>
+   static PerLink<T> row (T *field, NodeID node) {
+      return PerLink<T>(field + (size_t)node.id * EPOCH_LENGTH);
+   }
+};
+
+extern LinkArena link_arena;
+
+#endif
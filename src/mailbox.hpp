@@ -0,0 +1,36 @@
+#ifndef __MAILBOX_H
+#define __MAILBOX_H
+
+#include <vector>
+
+//Receive side of a link, indexed by the tick in which an entry was sent.
+//An entry sent at tick t is received with cur_tick == t, PROP_DELAY_TS ticks later. Senders may run up to LOOKAHEAD_TS
+//ticks ahead of the receiver, so PROP_DELAY_TS + LOOKAHEAD_TS slots suffice.
+//A slot that was not written since it was last taken holds the empty value, which is what an idle sender would have sent.
+template <typename T>
+class Mailbox {
+   std::vector<T> slots;
+   T empty_value;
+
+   public:
+   void set_capacity (int capacity, T empty) {
+      empty_value = empty;
+      slots.assign(capacity, empty);
+   }
+
+   T &slot (int tick) {
+      return slots[tick % slots.size()];
+   }
+
+   T take (int tick) {
+      T &entry = slot(tick);
+      T value = entry;
+      entry = empty_value;
+      return value;
+   }
+
+   typename std::vector<T>::iterator begin () { return slots.begin(); }
+   typename std::vector<T>::iterator end () { return slots.end(); }
+};
+
+#endif
@@ -1,7 +1,6 @@
 #include <string>
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <boost/program_options.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/tee.hpp>
@@ -15,27 +14,36 @@
 #include <chrono>
 #include <ctime>
 #include <numeric>
-#include <execution>
 #include <array>
+#include <thread>
+#include <memory>
+#include <random>
 #include "defines.hpp"
 #include "nodeid.hpp"
 #include "flow.hpp"
 #include "node.hpp"
 #include "util.hpp"
+#include "tick_engine.hpp"
+#include "fct_log.hpp"
+#include "statistics.hpp"
+#include "workload.hpp"
+#include "synthetic_workload.hpp"
+#include "result_writer.hpp"
+#include "snapshot_writer.hpp"
 #include <sys/time.h>
 #include <sys/resource.h>
 
 using namespace std;
 namespace po = boost::program_options;
 
-std::atomic_int completed_flows = 0;
-std::atomic_uint64_t total_frames_recvd = 0;
-std::ofstream fct_csv;
-std::atomic_int *active_flows_with_dest;
+FctLog fct_log;
+ResultWriter packet_trace;
+Statistics statistics;
 
 int NUM_PHASES = 3;
 int NODES_PER_PHASE = 16;
 int PROP_DELAY_TS = 0;
+int LOOKAHEAD_TS = 1;
 int MAX_NODE_ID = 4096;
 const BucketID INVALID_BUCKET = {INT_MAX};
 BucketID DIRECT_TO_DEST_BUCKET = {MAX_NODE_ID * NUM_PHASES + 1};
@@ -61,16 +69,43 @@ int RD_MAX_QUEUE_LENGTH;
 
 double TOTAL_FSR = 1;
 
+double TRACE_SAMPLE_RATE = 0;
+
+ResultFormat RESULT_FORMAT = RESULTS_CSV;
+
+uint64_t RANDOM_SEED = 1;
+
 double TSFRAC = 1;
 
 bool *is_failed_node;
+NodeActivity *node_activity;
+LinkArena link_arena;
+RoutingTable routing_table;
 
 void fail_n_nodes (int num_to_fail, std::vector<Node *> nodes);
 void coordinate_loop (std::vector<int> &idxs_to_fail, int *coords, const int cur_coord, const int sum, const int sum_so_far);
 
 
 int main(int argc, const char *argv[]) {
-   ifstream testcase;
+   if (argc >= 2 && string(argv[1]) == "convert") {
+      if (argc != 4) {
+         cerr << "Usage: " << argv[0] << " convert <test case CSV file> <binary workload file>" << endl;
+         return 1;
+      }
+      convert_workload(argv[2], argv[3], std::max(1u, std::thread::hardware_concurrency()), cout, cerr);
+      return 0;
+   }
+   if (argc >= 2 && string(argv[1]) == "results-to-csv") {
+      if (argc < 3) {
+         cerr << "Usage: " << argv[0] << " results-to-csv <output directory or binary result table>..." << endl;
+         return 1;
+      }
+      for (int i = 2; i < argc; i++) {
+         convert_results(argv[i], cout);
+      }
+      return 0;
+   }
+
    std::filesystem::path output_dir;
 
    typedef boost::iostreams::tee_device<std::ostream, std::ofstream> Tee;
@@ -80,8 +115,17 @@ int main(int argc, const char *argv[]) {
    po::options_description desc{"Options"};
    desc.add_options()
       ("help,h", "Show this help")
-      ("input,i", po::value<string>(), "Filename of test case (required)")
+      ("input,i", po::value<string>(), "Filename of test case (required unless --synthetic-load is given, which it cannot be used with): a CSV file, or a binary workload made with the convert subcommand")
+      ("stream-flows", po::bool_switch(), "Read the test case during the simulation instead of up front, so that only the flows that have started take up memory. The test case must be sorted by start time, and is not cached")
+      ("no-workload-cache", po::bool_switch(), "Always parse a CSV test case, without reading or writing the parsed flows cached next to it")
+      ("trust-workload-mtime", po::bool_switch(), "Use the parsed flows cached next to a CSV test case without hashing the test case if its size and modification time are unchanged. Only the 4 most recently used caches of a test case are kept")
+      ("synthetic-load", po::value<double>()->default_value(0), "Generate the workload during the simulation instead of reading a test case: every sending node starts flows as a Poisson process that takes up this fraction of its sending capacity. Needs a limit on timeslots or flows. 0 = disabled")
+      ("flow-size-cdf", po::value<string>()->default_value("datamining"), "Flow size distribution of a synthetic workload: datamining (pFabric's data mining workload), or a CDF file with a size in bytes and a cumulative probability (the last column) per line")
+      ("traffic-pattern", po::value<string>()->default_value("uniform"), "Destinations of a synthetic workload: uniform (any other node), permutation (a fixed other node per sender) or incast (every other node sends to one of --incast-receivers random nodes)")
+      ("incast-receivers", po::value<int>()->default_value(1), "Number of receivers of the incast traffic pattern")
+      ("workload-seed", po::value<uint64_t>()->default_value(1), "Seed of a synthetic workload")
       ("output,o", po::value<string>(), "Output directory")
+      ("result-format", po::value<string>()->default_value("csv"), "Format of the result tables (fct.csv, the snapshots, ...): csv, binary (raw 64-bit columns) or packed (delta and varint coded columns). Binary tables are written as .res files, which the results-to-csv subcommand turns into the usual CSV files")
       ("payload-length,p", po::value<int>()->default_value(52), "Payload length in bytes")
       ("slot-length,s", po::value<double>()->default_value(5.632e-9), "Timeslot length in seconds")
       ("propagation-delay,d", po::value<double>()->default_value(0), "Propagation delay in seconds")
@@ -89,10 +133,11 @@ int main(int argc, const char *argv[]) {
       ("num-nodes,n", po::value<int>()->default_value(4096), "Total number of nodes to simulate (including failed nodes)")
       ("max-ticks,t", po::value<int>()->default_value(0), "Maximum number of timeslots to simulate. 0 = unlimited")
       ("max-flows,f", po::value<int>()->default_value(0), "Maximum number of flows to finish before terminating simulation. 0 = unlimited")
+      ("snapshot-interval", po::value<int>()->default_value(1000000), "Number of timeslots between the snapshots of buffer occupancy (and, with hop-by-hop, of active buckets) written to the output directory. 0 = no snapshots")
       ("max-flows-read", po::value<int>()->default_value(0), "Maximum number of flows to read from the input file. 0 = unlimited")
       ("num-failed-nodes,F", po::value<int>()->default_value(0), "Number of failed nodes to simulate. Note: workload must not use node IDs above n-F (i.e. failed nodes must not be included in the workload)")
       ("flow-size-multiplier,X", po::value<double>()->default_value(1), "Multiplier by which to adjust flow sizes")
-      ("load-factor-adjust,L", po::value<double>()->default_value(1), "Value by which to divide flow start times (thus adjusting load)")
+      ("load-factor-adjust,L", po::value<double>()->default_value(1), "Value by which to divide flow start times (thus adjusting load). Not used with --synthetic-load, which sets the load itself")
       ("max-flow-size,m", po::value<int>()->default_value(0), "Ignore flows with size above this argument. 0 = disabled")
       ("min-flow-size,M", po::value<int>()->default_value(0), "Ignore flows with size below this argument. 0 = disabled")
       ("hop-by-hop,H", po::bool_switch(&USE_HBH), "Use hop-by-hop congestion control")
@@ -111,6 +156,10 @@ int main(int argc, const char *argv[]) {
       ("spray-via-shortest,S", po::bool_switch(&SPRAY_SHORT), "Spray via the shortest outgoing queue (breaking ties randomly)")
       ("spray-via-shortest-bucket,B", po::bool_switch(&SPRAY_BUCKET), "Spray via the outgoing queue with the greatest number of remaining tokens, breaking ties by the shortest overall length (requires -S to be set)")
       ("timeslot-fraction", po::value<double>()->default_value(1), "For interleaving, fraction of timeslots allocated to the current schedule")
+      ("threads,j", po::value<int>()->default_value(0), "Number of worker threads, each pinned to a CPU and owning a fixed set of nodes. 0 = one per available CPU")
+      ("seed", po::value<uint64_t>(&RANDOM_SEED)->default_value(1), "Seed of the random choices (e.g. of spray links). Runs with the same seed and inputs give the same results, whatever the number of threads")
+      ("trace-sample-rate", po::value<double>(&TRACE_SAMPLE_RATE)->default_value(0), "Fraction of frames whose per-hop send ticks are written to packet-trace.csv (sampled by flow and sequence number). 0 = disabled")
+      ("lookahead,w", po::bool_switch(), "Let the worker threads run up to propagation-delay timeslots between synchronizations. Results are unchanged, except that fair sending rates are only updated at the start of each window, and flow/timeslot limits are only checked between windows (so up to propagation-delay - 1 extra timeslots may be simulated)")
       ;
 
 
@@ -122,10 +171,29 @@ int main(int argc, const char *argv[]) {
       cerr << desc << endl;
       return 0;
    }
-   if(!vm.count("input")) {
+   double synthetic_load = vm["synthetic-load"].as<double>();
+   if(!vm.count("input") && synthetic_load == 0) {
       cerr << desc << endl;
       return 1;
    }
+   if(synthetic_load > 0 && vm.count("input")) {
+      cerr << "Error: --input and --synthetic-load cannot be used together" << endl;
+      return 1;
+   }
+   //a synthetic workload's load is set by --synthetic-load alone
+   if(synthetic_load > 0 && vm["load-factor-adjust"].as<double>() != 1) {
+      cerr << "Error: --load-factor-adjust cannot be used with --synthetic-load" << endl;
+      return 1;
+   }
+   string result_format = vm["result-format"].as<string>();
+   if(result_format == "binary") {
+      RESULT_FORMAT = RESULTS_BINARY;
+   } else if(result_format == "packed") {
+      RESULT_FORMAT = RESULTS_PACKED;
+   } else if(result_format != "csv") {
+      cerr << "Error: unknown result format " << result_format << endl;
+      return 1;
+   }
 
    bool logging = false;
    if(!vm.count("output")) {
@@ -141,16 +209,17 @@ int main(int argc, const char *argv[]) {
 
       std::filesystem::create_directories(output_dir);
 
-      if(std::filesystem::exists(output_dir / "fct.csv")) {
+      std::filesystem::path fct_path = ResultWriter::path_for(output_dir / "fct.csv");
+      if(std::filesystem::exists(fct_path)) {
          const std::time_t now = std::time(nullptr);
-         std::filesystem::rename(output_dir / "fct.csv",
-                  output_dir / ("fct.csv-"+boost::lexical_cast<std::string>(now)));
+         std::filesystem::rename(fct_path, fct_path.string() + "-" + boost::lexical_cast<std::string>(now));
       }
 
-      fct_csv.open(output_dir / "fct.csv");
-      if(!fct_csv.is_open()) {
-         cerr << "Error: could not open file " << output_dir / "fct.csv" << " for writing" << endl;
-         exit(EXIT_FAILURE);
+      //completed flows are spilled here during the run, and sorted into fct.csv at the end
+      fct_log.open(output_dir / "fct.bin");
+      if(TRACE_SAMPLE_RATE > 0) {
+         packet_trace.open(output_dir / "packet-trace.csv",
+                           {{"flow_id", false}, {"sequence_num", false}, {"hop", false}, {"tick", false}});
       }
       logfile.open(output_dir / "log");
       if(!logfile.is_open()) {
@@ -171,9 +240,15 @@ int main(int argc, const char *argv[]) {
       logged_cout << "Output directory: " << vm["output"].as<string>() << endl;
    }
 
-   logged_cout << "Test case filename: " << vm["input"].as<string>() << endl;
-   testcase.open(vm["input"].as<string>());
-   if (!testcase.is_open()) {
+   if (synthetic_load > 0) {
+      logged_cout << "Synthetic workload: load " << synthetic_load << ", flow sizes " << vm["flow-size-cdf"].as<string>()
+                  << ", traffic pattern " << vm["traffic-pattern"].as<string>() << ", seed "
+                  << vm["workload-seed"].as<uint64_t>() << endl;
+   } else {
+      logged_cout << "Test case filename: " << vm["input"].as<string>() << endl;
+   }
+   logged_cout << "Random seed: " << RANDOM_SEED << endl;
+   if (synthetic_load == 0 && !std::ifstream(vm["input"].as<string>()).is_open()) {
       logged_cerr << "Error: could not open file " << vm["input"].as<string>() << endl;
       exit(EXIT_FAILURE);
    }
@@ -193,6 +268,13 @@ int main(int argc, const char *argv[]) {
       prop_delay_seconds = 0;
    }
    PROP_DELAY_TS = ceil(prop_delay_seconds / SLOT_LENGTH_INCL_GB);
+   if(vm["lookahead"].as<bool>()) {
+      if(PROP_DELAY_TS == 0) {
+         logged_cerr << "Warning: lookahead requires a nonzero propagation delay, synchronizing every timeslot instead" << endl;
+      } else {
+         LOOKAHEAD_TS = PROP_DELAY_TS;
+      }
+   }
 
 
    NUM_PHASES = vm["num-phases"].as<int>();
@@ -202,10 +284,21 @@ int main(int argc, const char *argv[]) {
    }
    int num_nodes = vm["num-nodes"].as<int>();
    NODES_PER_PHASE = ceil(pow(num_nodes, 1.0 / (double)NUM_PHASES));
+   if(NODES_PER_PHASE > UINT16_MAX + 1) {
+      logged_cerr << "Error: more than " << UINT16_MAX + 1 << " nodes per phase (links are numbered in 16 bits)" << endl;
+      exit(EXIT_FAILURE);
+   }
+   if(pow(NODES_PER_PHASE,NUM_PHASES) > INT_MAX) {
+      logged_cerr << "Error: " << NODES_PER_PHASE << "^" << NUM_PHASES << " nodes do not fit in node IDs" << endl;
+      exit(EXIT_FAILURE);
+   }
    MAX_NODE_ID = pow(NODES_PER_PHASE,NUM_PHASES);
    DIRECT_TO_DEST_BUCKET = {MAX_NODE_ID * NUM_PHASES + 1};
 
-   active_flows_with_dest = new std::atomic_int[MAX_NODE_ID]();
+   statistics.set_num_nodes(MAX_NODE_ID);
+   node_activity = new NodeActivity[MAX_NODE_ID]();
+   link_arena.allocate(MAX_NODE_ID);
+   routing_table.build(MAX_NODE_ID);
 
    int max_flows = vm["max-flows"].as<int>();
    if(max_flows == 0) max_flows = INT_MAX;
@@ -214,6 +307,7 @@ int main(int argc, const char *argv[]) {
    if(max_ticks == 0) max_ticks = INT_MAX;
    int max_flows_read = vm["max-flows-read"].as<int>();
    if(max_flows_read == 0) max_flows_read = INT_MAX;
+   int snapshot_interval = vm["snapshot-interval"].as<int>();
    double flow_size_multiplier = vm["flow-size-multiplier"].as<double>();
    double load_factor = vm["load-factor-adjust"].as<double>();
 
@@ -282,7 +376,7 @@ int main(int argc, const char *argv[]) {
    nodes.resize(MAX_NODE_ID);
    for(int i = 0; i < MAX_NODE_ID; i++){
       NodeID id = {i};
-      nodes[i] = new Node(id);
+      nodes[i] = Node::create(id);
       nodes[i]->credit_interval = 2*NUM_PHASES;
    }
    for(int i = 0; i < MAX_NODE_ID; i++){
@@ -303,7 +397,7 @@ int main(int argc, const char *argv[]) {
 
       ttable.push_back(i);
    }
-   assert(ttable.size() == num_good_nodes);
+   assert((int)ttable.size() == num_good_nodes);
    logged_cout << "Num remaining nodes: " << num_good_nodes << " nodes" << std::endl;
 
 
@@ -314,149 +408,194 @@ int main(int argc, const char *argv[]) {
 
 
 
-   int num_flows = 0;
-
-
-
-   string line;
-   while(testcase.peek() != EOF && num_flows < max_flows_read){
-      getline(testcase, line);
-      stringstream ss(line);
-
-      Flow flow;
-      int read_id;
-
-      ss >> flow.flow_id;
-      if(ss.peek() == ',') ss.ignore();
-      ss >> read_id;
-      flow.source_id.id = ttable[read_id];
-      if(ss.peek() == ',') ss.ignore();
-      ss >> read_id;
-      flow.dest_id.id = ttable[read_id];
-      if(ss.peek() == ',') ss.ignore();
-
+   int num_threads = vm["threads"].as<int>();
+   if(num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
 
-      int flow_length; ss >> flow_length;
-      if (flow_length < min_flow_size) continue;
-      if (flow_length > max_flow_size) continue;
-      flow_length = (int)(flow_length * flow_size_multiplier);
-      flow.num_frames = (flow_length + PAYLOAD_LENGTH - 1) / PAYLOAD_LENGTH;
-      flow.remain_frames = flow.num_frames;
-      flow.quantized_num_frames = *std::prev(std::upper_bound(quantization_vector.begin(), quantization_vector.end(), flow.num_frames));
-      if(ss.peek() == ',') ss.ignore();
+   WorkloadOptions workload_options;
+   workload_options.max_flows = max_flows_read;
+   workload_options.min_flow_size = min_flow_size;
+   workload_options.max_flow_size = max_flow_size;
+   workload_options.flow_size_multiplier = flow_size_multiplier;
+   workload_options.load_factor = load_factor;
+   workload_options.payload_length = PAYLOAD_LENGTH;
+   workload_options.slot_length = SLOT_LENGTH_INCL_GB;
+   workload_options.node_of_id = &ttable;
+   workload_options.quantization_levels = &quantization_vector;
+   workload_options.errors = &logged_cerr;
 
-      double start_time; ss >> start_time;
-      flow.start_tick = (start_time/load_factor) / SLOT_LENGTH_INCL_GB;
-
-      if(flow.start_tick < 0) {
-         break;
+   //With --stream-flows or a synthetic workload, flows are handed to the nodes window by window, just before they
+   //start. Until the stream runs dry, the number of flows is not known.
+   std::unique_ptr<FlowStream> flow_stream;
+   int num_flows = INT_MAX;
+   if (synthetic_load > 0) {
+      if (max_ticks == INT_MAX && max_flows == INT_MAX && max_flows_read == INT_MAX) {
+         logged_cerr << "Error: a synthetic workload needs --max-ticks, --max-flows or --max-flows-read" << endl;
+         exit(EXIT_FAILURE);
       }
-
-      nodes[flow.source_id]->add_send_flow(flow);
-      nodes[flow.dest_id]->add_recv_flow(flow);
-
-      num_flows++;
-   }
-
-   int first_received_tick[EPOCH_LENGTH];
-   int first_received_feedback_tick[EPOCH_LENGTH];
-   for (int i = 0; i < EPOCH_LENGTH; i++) {
-      first_received_tick[i] = -1;
-      first_received_feedback_tick[i]=-1;
+      SyntheticOptions synthetic_options;
+      synthetic_options.num_nodes = num_good_nodes;
+      synthetic_options.load = synthetic_load;
+      synthetic_options.bytes_per_tick = PAYLOAD_LENGTH;
+      synthetic_options.slot_length = SLOT_LENGTH_INCL_GB;
+      synthetic_options.incast_receivers = vm["incast-receivers"].as<int>();
+      synthetic_options.seed = vm["workload-seed"].as<uint64_t>();
+      if (!SyntheticWorkload::parse_pattern(vm["traffic-pattern"].as<string>(), synthetic_options.pattern)) {
+         logged_cerr << "Error: unknown traffic pattern " << vm["traffic-pattern"].as<string>() << endl;
+         exit(EXIT_FAILURE);
+      }
+      string cdf_name = vm["flow-size-cdf"].as<string>();
+      FlowSizeCdf cdf = cdf_name == "datamining" ? FlowSizeCdf::datamining() : FlowSizeCdf::from_file(cdf_name);
+      logged_cout << "Mean synthetic flow size: " << cdf.mean() << " bytes" << endl;
+      flow_stream = std::make_unique<FlowStream>(std::make_unique<SyntheticWorkload>(cdf, synthetic_options),
+                                                 workload_options);
+   } else if (vm["stream-flows"].as<bool>()) {
+      flow_stream = std::make_unique<FlowStream>(vm["input"].as<string>(), workload_options);
+      logged_cout << "Streaming flows from the workload" << endl;
+   } else {
+      auto parse_start_time = std::chrono::steady_clock::now();
+      WorkloadCache cache = vm["no-workload-cache"].as<bool>() ? WORKLOAD_CACHE_OFF
+                            : vm["trust-workload-mtime"].as<bool>() ? WORKLOAD_CACHE_TRUST_MTIME : WORKLOAD_CACHE_ON;
+      std::vector<Flow> flows = read_workload(vm["input"].as<string>(), workload_options, num_threads, cache,
+                                              logged_cout);
+      std::chrono::duration<double> parse_seconds = std::chrono::steady_clock::now() - parse_start_time;
+      double input_mb = std::filesystem::file_size(vm["input"].as<string>()) / 1e6;
+      logged_cout << "Workload read: " << flows.size() << " flows from " << input_mb << " MB in " << parse_seconds.count()
+                  << " s (" << input_mb / parse_seconds.count() << " MB/s)" << endl;
+
+      for (const Flow &flow : flows) {
+         nodes[flow.source_id]->add_send_flow(flow);
+         nodes[flow.dest_id]->add_recv_flow(flow);
+      }
+      num_flows = flows.size();
    }
 
-   std::ofstream recvd_frames_file;
+   ResultWriter recvd_frames_table;
    if(logging) {
-      if(std::filesystem::exists(output_dir / "recvd_frames.csv")) {
+      std::filesystem::path recvd_frames_path = ResultWriter::path_for(output_dir / "recvd_frames.csv");
+      if(std::filesystem::exists(recvd_frames_path)) {
          const std::time_t now = std::time(nullptr);
-         std::filesystem::rename(output_dir / "recvd_frames.csv",
-                                 output_dir / ("recvd_frames.csv-"+boost::lexical_cast<std::string>(now)));
+         std::filesystem::rename(recvd_frames_path,
+                                 recvd_frames_path.string() + "-" + boost::lexical_cast<std::string>(now));
       }
-      recvd_frames_file.open(output_dir / "recvd_frames.csv");
-      recvd_frames_file << 0 << "," << 0 << std::endl;
+      recvd_frames_table.open(output_dir / "recvd_frames.csv", {{"tick", false}, {"frames_received", false}});
+      recvd_frames_table.row({0, 0});
+   }
+
+   //A snapshot is gathered by the workers at the start of the first window after its boundary, and written in the
+   //background once that window is over.
+   SnapshotWriter snapshot_writer;
+   if(logging && snapshot_interval > 0) {
+      snapshot_writer.open(output_dir);
    }
+   std::unique_ptr<Snapshot> pending_snapshot;
+   int next_snapshot = 1; //snapshot k is taken k intervals into the run, so there is none at tick 0
 
    //main loop
-   int send_tick;
-   for(send_tick = 0; (completed_flows < num_flows) && (completed_flows < max_flows) && (send_tick < max_ticks + PROP_DELAY_TS); send_tick++){
+   TickEngine engine(nodes, num_threads);
+   logged_cout << "Running with " << engine.workers() << " worker threads" << endl;
+   if (Node::kernel().nodes_per_phase > 0) {
+      logged_cout << "Running with nodes specialized for h = " << NUM_PHASES << ", " << NODES_PER_PHASE << " nodes per phase and the selected protocol features" << endl;
+   } else if (Node::kernel().phases > 0) {
+      logged_cout << "Running with nodes specialized for h = " << NUM_PHASES << " and the selected protocol features" << endl;
+   } else {
+      logged_cout << "Running with generic nodes (no specialization for h = " << NUM_PHASES << " and the selected protocol features)" << endl;
+   }
+
+   //called serially at the start of every window, while all workers are parked
+   int send_tick = 0;
+   long fast_forwarded_ticks = 0;
+   engine.run([&](TickPlan &plan) {
+      if (pending_snapshot) {
+         snapshot_writer.submit(std::move(pending_snapshot));
+      }
+      plan.snapshot = NULL;
+      send_tick = plan.end_send_tick;
       int receive_tick = send_tick - PROP_DELAY_TS;
+      int64_t completed_flows = statistics.total(STAT_COMPLETED_FLOWS);
+      if (flow_stream && flow_stream->next_start_tick() == INT_MAX) {
+         num_flows = flow_stream->flows_read();
+      }
+      uint64_t total_frames_recvd = statistics.total(STAT_FRAMES_RECEIVED);
+      if (completed_flows >= num_flows || completed_flows >= max_flows || receive_tick >= max_ticks) {
+         return false;
+      }
+
+      //The next per-million-tick or snapshot boundary, as a send tick.
+      auto next_boundary_tick = [&]() {
+         long next_million_tick = (long)ceil(total_frames_recvd_M.size() * 1000000 * TSFRAC) + PROP_DELAY_TS;
+         long next_snapshot_tick = LONG_MAX;
+         if (snapshot_interval > 0) {
+            next_snapshot_tick = (long)ceil((double)next_snapshot * snapshot_interval * TSFRAC) + PROP_DELAY_TS;
+         }
+         return std::min(next_million_tick, next_snapshot_tick);
+      };
+
+      //If every node was idle at the end of the last window, nothing happens until the next flow starts,
+      //so jump straight there. Stop at boundaries and at the tick limit so that those are unaffected.
+      long last_tick = (long)max_ticks + PROP_DELAY_TS;
+      long next_streamed_tick = flow_stream ? flow_stream->next_start_tick() : INT_MAX;
+      long target_tick = std::min({(long)engine.next_busy_tick(), next_streamed_tick, next_boundary_tick(), last_tick});
+      if (target_tick > send_tick) {
+         fast_forwarded_ticks += target_tick - send_tick;
+         send_tick = target_tick;
+         receive_tick = send_tick - PROP_DELAY_TS;
+         if (receive_tick >= max_ticks) {
+            return false;
+         }
+      }
+
       if(receive_tick >= total_frames_recvd_M.size() * 1000000 * TSFRAC) {
          total_frames_recvd_M.push_back(total_frames_recvd);
          if(logging) {
-            recvd_frames_file << receive_tick << "," << total_frames_recvd << std::endl;
-
-            if(USE_HBH){
-               std::ofstream active_buckets_file;
-               active_buckets_file.open(output_dir / ("active-buckets-"+std::to_string(receive_tick)+".csv"));
-               for (auto node : nodes) {
-                  node->record_cur_buckets_in_use(active_buckets_file);
-               }
-            }
-            std::ofstream buffer_occupancy_file;
-            buffer_occupancy_file.open(output_dir / ("buffer-occupancy-"+std::to_string(receive_tick)+".csv"));
-            for (auto node : nodes) {
-               node->record_cur_buffer_occupancy(buffer_occupancy_file);
-            }
+            recvd_frames_table.row({receive_tick, (int64_t)total_frames_recvd});
          }
       }
-      if (receive_tick >= 0 && receive_tick % 100 == 0) {
-         logged_cout << "starting tick " << receive_tick << "    completed flows: " << completed_flows << endl;
-      }
-      if (USE_FSR) {
-         std::for_each(std::execution::par, std::begin(nodes), std::end(nodes), [=](auto&& node) {
-            node->adjust_flow_credit(send_tick);
-         });
-      }
-      std::for_each(std::execution::par, std::begin(nodes), std::end(nodes), [=](auto&& node) {
-         node->send_packet(send_tick);
-      });
-      if (USE_RD) {
-         std::for_each(std::execution::par, std::begin(nodes), std::end(nodes), [=](auto&& node) {
-            node->send_rdc(send_tick);
-         });
-      }
-      if (USE_HBH && first_received_tick[send_tick % EPOCH_LENGTH] >= 0) {
-         std::for_each(std::execution::par, std::begin(nodes), std::end(nodes), [=](auto&& node) {
-            node->send_tokens(send_tick);
-         });
-         if (send_tick - first_received_tick[send_tick % EPOCH_LENGTH] <= EPOCH_LENGTH) {
-            first_received_feedback_tick[send_tick % EPOCH_LENGTH] = send_tick;
+      if(snapshot_interval > 0 && receive_tick >= (double)next_snapshot * snapshot_interval * TSFRAC) {
+         next_snapshot++;
+         if(logging) {
+            pending_snapshot = snapshot_writer.acquire(receive_tick, MAX_NODE_ID, USE_HBH);
+            plan.snapshot = pending_snapshot.get();
          }
       }
-      if(receive_tick >= 0) {
-         if (receive_tick < EPOCH_LENGTH) {
-            int cur_phase = (receive_tick / LINKS_PER_PHASE) % NUM_PHASES;
-            int cur_link = receive_tick % LINKS_PER_PHASE;
-            int recv_link = LINKS_PER_PHASE - 1 - cur_link;
-            int recv_index = recv_link + cur_phase * LINKS_PER_PHASE;
-            first_received_tick[recv_index] = receive_tick + PROP_DELAY_TS;
-         }
-         std::for_each(std::execution::par, std::begin(nodes), std::end(nodes), [=](auto&& node) {
-            node->receive_packet(receive_tick);
-         });
-         if (USE_RD) {
-            std::for_each(std::execution::par, std::begin(nodes), std::end(nodes), [=](auto&& node) {
-               node->receive_rdc(receive_tick);
-            });
-         }
-         if (USE_HBH && first_received_feedback_tick[receive_tick % EPOCH_LENGTH] >= 0
-             && receive_tick >= first_received_feedback_tick[receive_tick % EPOCH_LENGTH]) {
-            std::for_each(std::execution::par, std::begin(nodes), std::end(nodes), [=](auto&& node) {
-               node->receive_tokens(receive_tick);
-            });
+
+      //The window ends early at the next boundary and at the tick limit, so that those are unaffected.
+      long window_end = std::min({(long)send_tick + LOOKAHEAD_TS, next_boundary_tick(), last_tick});
+      window_end = std::max(window_end, (long)send_tick + 1);
+
+      //every hundredth receive tick of the window, with the flows completed by the start of the window
+      for (long tick = (std::max(receive_tick, 0) + 99) / 100 * 100; tick < window_end - PROP_DELAY_TS; tick += 100) {
+         logged_cout << "starting tick " << tick << "    completed flows: " << completed_flows << endl;
+      }
+
+      if (flow_stream) {
+         while (flow_stream->next_start_tick() < window_end) {
+            Flow flow = flow_stream->take();
+            nodes[flow.source_id]->add_send_flow(flow);
+            nodes[flow.dest_id]->add_recv_flow(flow);
+            nodes[flow.source_id]->update_wake_tick();
          }
       }
-   }
+
+      plan.first_send_tick = send_tick;
+      plan.end_send_tick = window_end;
+      return true;
+   });
    int last_completed_tick = send_tick - PROP_DELAY_TS;
+   uint64_t total_frames_recvd = statistics.total(STAT_FRAMES_RECEIVED);
 
    if (logging) {
-      recvd_frames_file << last_completed_tick << "," << total_frames_recvd << std::endl;
+      recvd_frames_table.row({last_completed_tick, (int64_t)total_frames_recvd});
+      recvd_frames_table.close();
+      fct_log.close(output_dir / "fct.csv");
+      packet_trace.close();
+      snapshot_writer.close();
    }
 
    total_frames_recvd_M.push_back(total_frames_recvd);
 
    logged_cout << endl;
    logged_cout << "Simulation complete. Total timeslots: " << last_completed_tick << endl;
+   logged_cout << "Fast-forwarded over " << fast_forwarded_ticks << " idle timeslots" << endl;
    logged_cout << endl;
 
 
@@ -486,52 +625,52 @@ int main(int argc, const char *argv[]) {
 
 
    if(USE_HBH && logging) {
-      std::ofstream active_buckets_file;
-      active_buckets_file.open(output_dir / "max-active-buckets.csv");
+      ResultWriter active_buckets_table;
+      active_buckets_table.open(output_dir / "max-active-buckets.csv", Node::NODE_COLUMNS);
       for (auto node : nodes) {
-         node->record_max_buckets_in_use(active_buckets_file);
+         node->record_max_buckets_in_use(active_buckets_table);
       }
    }
    if(USE_HBH && logging) {
-      std::ofstream active_buckets_file;
-      active_buckets_file.open(output_dir / "active-buckets-final.csv");
+      ResultWriter active_buckets_table;
+      active_buckets_table.open(output_dir / "active-buckets-final.csv", Node::NODE_COLUMNS);
       for (auto node : nodes) {
-         node->record_cur_buckets_in_use(active_buckets_file);
+         node->record_cur_buckets_in_use(active_buckets_table);
       }
    }
    if(logging) {
-      std::ofstream queue_lengths_file;
-      queue_lengths_file.open(output_dir / "max-queue-lengths.csv");
+      ResultWriter queue_lengths_table;
+      queue_lengths_table.open(output_dir / "max-queue-lengths.csv", Node::LINK_COLUMNS);
       for (auto node : nodes) {
-         node->record_max_enqueued_frames(queue_lengths_file);
+         node->record_max_enqueued_frames(queue_lengths_table);
       }
    }
    if(logging) {
-      std::ofstream queue_lengths_file;
-      queue_lengths_file.open(output_dir / "queue-lengths-final.csv");
+      ResultWriter queue_lengths_table;
+      queue_lengths_table.open(output_dir / "queue-lengths-final.csv", Node::LINK_COLUMNS);
       for (auto node : nodes) {
-         node->record_cur_enqueued_frames(queue_lengths_file);
+         node->record_cur_enqueued_frames(queue_lengths_table);
       }
    }
    if(logging) {
-      std::ofstream buffer_occupancy_file;
-      buffer_occupancy_file.open(output_dir / "max-buffer-occupancy.csv");
+      ResultWriter buffer_occupancy_table;
+      buffer_occupancy_table.open(output_dir / "max-buffer-occupancy.csv", Node::NODE_COLUMNS);
       for (auto node : nodes) {
-         node->record_max_buffer_occupancy(buffer_occupancy_file);
+         node->record_max_buffer_occupancy(buffer_occupancy_table);
       }
    }
    if(logging) {
-      std::ofstream buffer_occupancy_file;
-      buffer_occupancy_file.open(output_dir / "buffer-occupancy-final.csv");
+      ResultWriter buffer_occupancy_table;
+      buffer_occupancy_table.open(output_dir / "buffer-occupancy-final.csv", Node::NODE_COLUMNS);
       for (auto node : nodes) {
-         node->record_cur_buffer_occupancy(buffer_occupancy_file);
+         node->record_cur_buffer_occupancy(buffer_occupancy_table);
       }
    }
    if(logging) {
-      std::ofstream incomplete_flows_file;
-      incomplete_flows_file.open(output_dir / "incomplete-flows.csv");
+      ResultWriter incomplete_flows_table;
+      incomplete_flows_table.open(output_dir / "incomplete-flows.csv", Node::INCOMPLETE_FLOW_COLUMNS);
       for (auto node : nodes) {
-         node->record_incomplete_flows(incomplete_flows_file, last_completed_tick);
+         node->record_incomplete_flows(incomplete_flows_table, last_completed_tick);
       }
    }
 
@@ -556,14 +695,22 @@ int main(int argc, const char *argv[]) {
       stats_file << "max_buffer_occupancy_bytes " << max_buffer_occupancy * PAYLOAD_LENGTH<< endl;
       stats_file << "total_frames_recvd " << total_frames_recvd << endl;
       stats_file << "total_system_throughput " << (double)total_frames_recvd / (double)MAX_NODE_ID / (double)(last_completed_tick/TSFRAC) << endl;
-      for(int m = 1; m < total_frames_recvd_M.size(); m++) {
+      for(int m = 1; m < (int)total_frames_recvd_M.size(); m++) {
       stats_file << "total_frames_recvd_by_t=" << m << "M " << total_frames_recvd_M[m] << endl;
       stats_file << "total_frames_recvd_after_t=" << m << "M " << total_frames_recvd - total_frames_recvd_M[m] << endl;
       stats_file << "total_system_throughput_after_t=" << m << "M " << (double)(total_frames_recvd - total_frames_recvd_M[m]) / (double)MAX_NODE_ID / (((double)last_completed_tick/TSFRAC) - 1000000*m) << endl;
       }
-      for(int m = 1; m <= total_frames_recvd_M.size(); m++) {
+      for(int m = 1; m <= (int)total_frames_recvd_M.size(); m++) {
       stats_file << "total_system_throughput_from_t=" << m-1 << "M_to_t=" << m << "M " << (double)(total_frames_recvd_M[m] - total_frames_recvd_M[m-1]) / (double)MAX_NODE_ID / 1000000.0 << endl;
       }
+      stats_file << "buffered_frames " << statistics.level(GAUGE_BUFFERED_FRAMES) << endl;
+      stats_file << "peak_buffered_frames " << statistics.peak(GAUGE_BUFFERED_FRAMES) << endl;
+      stats_file << "peak_buffered_frame_record_bytes " << statistics.peak(GAUGE_BUFFERED_FRAMES) * sizeof(PacketInfo) << endl;
+      if(TRACE_SAMPLE_RATE > 0) {
+         stats_file << "timestamp_pool_live_traces " << PacketTracePool::live() << endl;
+         stats_file << "timestamp_pool_peak_live_traces " << statistics.peak(GAUGE_LIVE_TRACES) << endl;
+         stats_file << "timestamp_pool_bytes " << PacketTracePool::reserved_bytes() << endl;
+      }
       stats_file << "elapsed_time_sec " << elapsed_seconds.count() << endl;
       stats_file << "max_rss_kbyte " << usage.ru_maxrss << endl;
    }
@@ -596,7 +743,7 @@ void fail_n_nodes (int num_to_fail, std::vector<Node *> nodes) {
 
       coordinate_loop(idxs_to_fail, coords, 0, sum, 0);
 
-      if (idxs_to_fail.size() > num_to_fail - num_failed) {
+      if ((int)idxs_to_fail.size() > num_to_fail - num_failed) {
          int num_to_fail_now = num_to_fail - num_failed;
          std::mt19937 random_generator(1);
          std::shuffle(idxs_to_fail.begin(), idxs_to_fail.end(), random_generator);
@@ -605,7 +752,7 @@ void fail_n_nodes (int num_to_fail, std::vector<Node *> nodes) {
          }
          num_failed += num_to_fail_now;
       } else {
-         for (int i = 0; i < idxs_to_fail.size(); i++) {
+         for (int i = 0; i < (int)idxs_to_fail.size(); i++) {
             nodes[idxs_to_fail[i]]->fail_node();
          }
          num_failed += idxs_to_fail.size();
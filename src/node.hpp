@@ -1,34 +1,58 @@
 #ifndef __NODE_H
 #define __NODE_H
 
-#include <map>
-#include <list>
 #include <vector>
-#include <boost/circular_buffer.hpp>
 #include <queue>
-#include <random>
+#include <algorithm>
+#include <cassert>
 #include "nodeid.hpp"
 #include "flow.hpp"
+#include "mailbox.hpp"
+#include "flat_index.hpp"
+#include "updatable_priority_queue.h"
+#include "slab_pool.hpp"
+#include "link_arena.hpp"
+#include "routing_table.hpp"
+#include "philox.hpp"
+#include "result_writer.hpp"
+#include "snapshot_writer.hpp"
+
+//Tick at which a sampled frame left each node on its path (see --trace-sample-rate).
+typedef struct {
+   int timestamp[MAX_PHASES*2];
+} PacketTrace;
+
+typedef SlabPool<PacketTrace> PacketTracePool;
 
+//A frame. It is copied by value through the mailboxes and bucket queues, so it is kept to 28 bytes.
 typedef struct {
    NodeID src;
    NodeID dest;
-   int hops;
-   int generated_tick;
    int sequence_num;
    int flow_id;
-   int timestamp[MAX_PHASES*2];
    int flow_length;
+   uint32_t trace;        //PacketTracePool handle, 0 unless the frame was sampled for tracing
+   uint8_t hops;
+   uint8_t sender_phase;  //link over which the frame reached the node that holds it, to return its token
+   uint16_t sender_link;
 } Packet;
 
+//What an idle link carries.
+const Packet NULL_PACKET = {{-1}, {-1}, -1, -1, 0, 0, 0, 0, 0};
+
+inline bool is_null_packet (const Packet &packet) {
+   return packet.dest.id < 0;
+}
+
+//A buffered frame. Its priority and the bucket it took a token from at the previous node follow from these fields
+//(see Node::priority_of and NodeImpl::previous_bucket), so they are not stored, which keeps it to 32 bytes.
 typedef struct {
-   Packet *packet;
-   int sender_phase;
-   int sender_link;
-   BucketID bucket;
-   int priority;
+   Packet packet;
+   int arrival_tick;
 } PacketInfo;
 
+static_assert(sizeof(PacketInfo) == 32, "a buffered frame should fit in half a cache line");
+
 typedef struct {
    BucketID tokens[TOKENS_PER_PACKET];
 } PacketTokens;
@@ -51,108 +75,327 @@ typedef struct {
    std::deque<PacketInfo> queue;
 } Bucket;
 
-class PriorityQueue : public std::priority_queue<std::pair<int,BucketID>, std::vector<std::pair<int,BucketID>>> {
+//The buckets of one outgoing link. Buckets live in a pool of slots that are recycled through a freelist,
+//and are found through a flat hash index on their BucketID.
+//References are only valid until the next find_or_create.
+class BucketTable {
+   FlatIndex index;
+   std::vector<Bucket> slots;
+   std::vector<int> free_slots;
+
+   public:
+   //The bucket, or NULL if it does not exist.
+   Bucket *find (BucketID bucket) {
+      int slot = index.find(bucket.id);
+      return slot == FlatIndex::NOT_FOUND ? NULL : &slots[slot];
+   }
+
+   //The bucket, which is created (with no outstanding tokens and an empty queue) if needed.
+   Bucket &find_or_create (BucketID bucket, bool &created) {
+      int &slot = index.find_or_insert(bucket.id, FlatIndex::NOT_FOUND, created);
+      if (created) {
+         if (free_slots.empty()) {
+            slot = slots.size();
+            slots.emplace_back();
+         } else {
+            slot = free_slots.back();
+            free_slots.pop_back();
+         }
+      }
+      return slots[slot];
+   }
+
+   Bucket &operator[] (BucketID bucket) {
+      bool created;
+      return find_or_create(bucket, created);
+   }
+
+   //Buckets keep their slot for as long as they exist, so slots can serve as dense bucket keys.
+   int slot_of (const Bucket &bucket_state) const { return &bucket_state - slots.data(); }
+   Bucket &at_slot (int slot) { return slots[slot]; }
+
+   //Buckets are only erased once they have no outstanding tokens and nothing queued.
+   void erase (BucketID bucket) {
+      int slot = index.erase(bucket.id);
+      if (slot == FlatIndex::NOT_FOUND) return;
+      slots[slot].num_outstanding_tokens = 0;
+      slots[slot].queue.clear();
+      free_slots.push_back(slot);
+   }
+};
+
+//Frames queued in a bucket plus its outstanding tokens (what -B sprays by), for every link of one phase.
+//Each BucketID that counts anything on some link has a row of LINKS_PER_PHASE counts, so that spraying can read
+//the counts of all of a phase's links at once.
+class BucketOccupancy {
+   FlatIndex row_of_bucket;
+   std::vector<int> counts;        //[row][link]
+   std::vector<int> nonzero_links; //[row]
+   std::vector<int> free_rows;
+   int links = 0;
+
    public:
-   void update(int new_priority, BucketID bucket);
-   void assert_does_not_contain(BucketID bucket);
+   void set_links (int num_links) { links = num_links; }
+
+   //The bucket's counts by link, or NULL if they are all zero.
+   const int *row (BucketID bucket) const {
+      int row = row_of_bucket.find(bucket.id);
+      return row == FlatIndex::NOT_FOUND ? NULL : &counts[(size_t)row * links];
+   }
+
+   void add (BucketID bucket, int link, int delta) {
+      bool inserted;
+      int &slot = row_of_bucket.find_or_insert(bucket.id, FlatIndex::NOT_FOUND, inserted);
+      if (inserted) {
+         if (free_rows.empty()) {
+            slot = nonzero_links.size();
+            nonzero_links.push_back(0);
+            counts.resize(counts.size() + links, 0);
+         } else {
+            slot = free_rows.back();
+            free_rows.pop_back();
+         }
+      }
+      int row = slot;
+      int &count = counts[(size_t)row * links + link];
+      if (count == 0) nonzero_links[row]++;
+      count += delta;
+      assert(count >= 0);
+      if (count == 0 && --nonzero_links[row] == 0) {
+         row_of_bucket.erase(bucket.id);
+         free_rows.push_back(row);
+      }
+   }
 };
 
+//The buckets of one outgoing link that have a frame ready to send, highest priority first (ties go to the higher
+//BucketID). Keyed by the buckets' slots in the link's BucketTable, so that a bucket can be found in O(1),
+//and its priority updated in O(log n).
+class PriorityQueue : public better_priority_queue::updatable_priority_queue<int,std::pair<int64_t,BucketID>> {
+   public:
+   int top_slot () const { return top().key; }
+   BucketID top_bucket () const { return top().priority.second; }
+
+   void push (int slot, int64_t priority, BucketID bucket) {
+      updatable_priority_queue::push(slot, {priority, bucket});
+   }
+
+   void update (int slot, int64_t new_priority, BucketID bucket) {
+      bool updated = updatable_priority_queue::update(slot, {new_priority, bucket});
+      assert(updated || contains(slot));
+   }
+
+   bool contains (int slot) const {
+      return slot < (int)id_to_heappos.size() && id_to_heappos[slot] < (size_t)-2;
+   }
+};
+
+//Protocol features, as bits of NodeImpl's FEATURES argument.
+const unsigned FEATURE_HBH            = 1 << 0;
+const unsigned FEATURE_RD             = 1 << 1;
+const unsigned FEATURE_PRIO           = 1 << 2;
+const unsigned FEATURE_FSR            = 1 << 3;
+const unsigned FEATURE_PRIO_LOG       = 1 << 4;
+const unsigned FEATURE_SPRAY_SHORT    = 1 << 5;
+const unsigned FEATURE_SPRAY_BUCKET   = 1 << 6;
+const unsigned FEATURE_QUANTIZED_PRIO = 1 << 7;
+
+//The features that change the shape of the per-frame stages. Every set of them has its own NodeImpl; the other
+//features only select between variants of a step, or add a step that is rarely taken, and are tested at runtime.
+const unsigned STATIC_FEATURES = FEATURE_HBH | FEATURE_RD | FEATURE_PRIO;
+
+//FEATURES value of the generic NodeImpl, which tests all flags at runtime.
+const unsigned RUNTIME_FEATURES = ~0u;
+
+//The features selected by the command line flags.
+inline unsigned enabled_features () {
+   return (USE_HBH ? FEATURE_HBH : 0u) | (USE_RD ? FEATURE_RD : 0u) | (USE_FSR ? FEATURE_FSR : 0u)
+          | (USE_PRIO ? FEATURE_PRIO : 0u) | (PRIO_LOG ? FEATURE_PRIO_LOG : 0u)
+          | (SPRAY_SHORT ? FEATURE_SPRAY_SHORT : 0u) | (SPRAY_BUCKET ? FEATURE_SPRAY_BUCKET : 0u)
+          | (QUANTIZED_PRIO ? FEATURE_QUANTIZED_PRIO : 0u);
+}
+
+class Node;
+
+//The per-frame stages of every node of a run, from the NodeImpl that Node::kernel picks for the run's flags.
+//send and receive run their half of a tick for the nodes in [begin, end) of nodes, skipping those with nothing to do,
+//so that the specialization is only dispatched on once per partition and tick.
+typedef struct {
+   Node *(*create) (NodeID id);
+   bool (*send) (Node *const *nodes, int begin, int end, int send_tick, bool send_tokens); //whether any node was awake
+   void (*receive) (Node *const *nodes, int begin, int end, int receive_tick, bool receive_tokens);
+   int phases;          //NUM_PHASES if the stages are specialized on it, 0 otherwise
+   int nodes_per_phase; //likewise for NODES_PER_PHASE
+} NodeKernel;
+
+//A node's state, and the stages that do not depend on the protocol features.
+//The per-frame stages are implemented by NodeImpl, which is specialized on the number of phases and on the
+//protocol features. Use Node::create to make a node of the right specialization.
 class Node {
 public:
    NodeID id;
    bool failed;
-private:
-   Node ***adjacent_node;
+protected:
+   //Per-(phase, link) state. Scalars live in the LinkArena, the rest in one array per node.
+   PerLink<Node *> adjacent_node;
+   PerLink<NodeID> adjacent_id;
 
    std::deque<Flow> send_flows;
-   std::list<Flow> currently_sending_flows;
-   std::list<Flow> finished_sending_flows;
-   std::list<Flow>::iterator **last_sent_flow;
+   SendingFlows currently_sending_flows; //one round-robin cursor per (phase, link)
 
-   std::map<int,Flow> receive_flows;
-   std::map<int,int> remaining_receive_frames;
+   std::vector<Flow> receive_flows; //slots of completed flows are reused, and have no frames remaining
+   FlatIndex receive_flow_slot;     //by flow ID, for the flows that have not completed
+   std::vector<int> free_receive_slots;
 
    int currently_receiving_long_flow_num;
 
-   bool **link_failed;
+   PerLink<bool> link_failed;
 
-   PriorityQueue **send_queue;
-   std::deque<BucketID> **token_queue;
-   std::map<BucketID,Bucket> **buckets;
-   int **max_send_queue_length;
-   int **cur_enqueued_frames_per_link;
-   int **max_enqueued_frames_per_link;
+   PerLink<PriorityQueue> send_queue;
+   PerLink<std::deque<BucketID>> token_queue;
+   PerLink<BucketTable> buckets;
+   PerLink<int> max_send_queue_length;
+   PerLink<int> cur_enqueued_frames_per_link;
+   PerLink<int> max_enqueued_frames_per_link;
    int cur_buffer_occupancy;
    int max_buffer_occupancy;
 
-   std::deque<RDControl> **rdc_send_queue;
+   PerLink<std::deque<RDControl>> rdc_send_queue;
    std::deque<RDControl> local_rdc_queue;
    double rd_pacing_delay = 0;
-   std::deque<Packet*> packet_retransmit_queue;
+   int rd_pacing_tick = -1;
+   std::deque<Packet> packet_retransmit_queue;
 
-   boost::circular_buffer<Packet*> received_packet_queue;
-   boost::circular_buffer<PacketTokens> received_tokens_queue;
-   boost::circular_buffer<RDControl> received_rdc_queue;
+   Mailbox<Packet> received_packet_queue;
+   Mailbox<PacketTokens> received_tokens_queue;
+   Mailbox<RDControl> received_rdc_queue;
+
+   //Entries in the per-link RDC and token send queues, so that has_outbound_work() does not need to scan them.
+   int pending_rdc;
+   int pending_tokens;
 
    int sent_frames;
-   std::map<BucketID,int> buckets_in_use;
+   FlatIndex buckets_in_use; //number of links with a bucket, by BucketID
    int cur_buckets_in_use;
    int max_buckets_in_use;
 
-   std::mt19937 random_generator;
-   std::vector<int> spray_order;
-   std::uniform_int_distribution<int> spray_distribution;
+   std::vector<uint64_t> spray_excluded; //coordinates excluded from the current spray hop, see RoutingTable
+   std::vector<int64_t> spray_keys;      //by link of the spray phase, see select_spray_link
+   std::vector<int> spray_ties;
+   std::vector<BucketOccupancy> bucket_occupancy; //by phase, only kept with -S -B
+
+   Node (NodeID id);
 
    public:
    int credit_interval;
 
-   Node (NodeID id);
+   //The kernel for NUM_PHASES, NODES_PER_PHASE and the enabled protocol features, picked on the first call.
+   //It must not be called before they are final.
+   static const NodeKernel &kernel ();
+   //enabled_features() of the run, taken once along with the kernel so a feature test is a single load
+   static unsigned features;
+   static Node *create (NodeID id) { return kernel().create(id); }
+
    void add_send_flow (Flow flow);
    void add_recv_flow (Flow flow);
    void set_adjacent_nodes (std::vector<Node *> nodes);
 
    void fail_node ();
 
+   void update_wake_tick ();
+
+   //Columns of the tables written by the record_ functions: per link, per node, and incomplete flows.
+   static const std::vector<ResultColumn> LINK_COLUMNS;
+   static const std::vector<ResultColumn> NODE_COLUMNS;
+   static const std::vector<ResultColumn> INCOMPLETE_FLOW_COLUMNS;
+
+   void record_current_queue_lengths (ResultWriter &table);
+   void record_max_queue_lengths (ResultWriter &table);
+   void add_max_queue_lengths (std::vector<int> &queue_lengths);
+   void add_max_buffer_occupancy (std::vector<int> &buffer_occupancies);
+   void record_cur_enqueued_frames (ResultWriter &table);
+   void record_max_enqueued_frames (ResultWriter &table);
+   void record_cur_buffer_occupancy (ResultWriter &table);
+   void record_max_buffer_occupancy (ResultWriter &table);
+   void record_incomplete_flows (ResultWriter &table, int cur_tick);
+
+   void add_max_buckets_in_use (std::vector<int> &buckets_in_use_vector);
+   void record_cur_buckets_in_use (ResultWriter &table);
+   void record_max_buckets_in_use (ResultWriter &table);
+
+   //Fills in this node's entries of snapshot.
+   void gather_snapshot (Snapshot &snapshot);
+
+   virtual ~Node();
+
+   protected:
+   bool has_outbound_work ();
+   void catch_up_rd_pacing (int cur_tick);
+   //With FSR, a sending flow pins an entry of its destination's active flow history from when it starts until it
+   //finishes (see Statistics).
+   void pin_flow_credit (Flow &flow);
+   void unpin_flow_credit (const Flow &flow);
+   void catch_up_flow_credit (Flow &flow, int cur_tick);
+
+   //Priority of a buffered frame, and so of the bucket it heads, in the send queue. Higher goes first.
+   static int64_t priority_of (const PacketInfo &packet_info);
+   void enqueue_bucket_for_sending (BucketID bucket, Bucket &bucket_state, int send_phase, int send_link);
+   void count_bucket_allocated (BucketID bucket);
+   void count_bucket_freed (BucketID bucket);
+};
+
+//The per-frame stages of a node. PHASES is NUM_PHASES and NPP is NODES_PER_PHASE, or 0 if they are only known at
+//runtime. FEATURES is the set of enabled STATIC_FEATURES, or RUNTIME_FEATURES to test all flags at runtime.
+//With them known, the compiler can unroll the loops over the phases, replace the divisions by the number of links
+//and drop the code of disabled features.
+template <int PHASES, int NPP, unsigned FEATURES>
+class NodeImpl : public Node {
+   public:
+   NodeImpl (NodeID id) : Node(id) {}
+
+   static Node *create (NodeID id) { return new NodeImpl(id); }
+   static bool send_stages (Node *const *nodes, int begin, int end, int send_tick, bool send_tokens);
+   static void receive_stages (Node *const *nodes, int begin, int end, int receive_tick, bool receive_tokens);
+
+   private:
    void send_packet (int cur_tick);
    void receive_packet (int cur_tick);
 
-   void adjust_flow_credit (int cur_tick);
-
    void send_tokens (int cur_tick);
    void receive_tokens (int cur_tick);
 
    void send_rdc (int cur_tick);
    void receive_rdc (int cur_tick);
 
-   void record_current_queue_lengths (std::ofstream &outfile);
-   void record_max_queue_lengths (std::ofstream &outfile);
-   void add_max_queue_lengths (std::vector<int> &queue_lengths);
-   void add_max_buffer_occupancy (std::vector<int> &buffer_occupancies);
-   void record_cur_enqueued_frames (std::ofstream &outfile);
-   void record_max_enqueued_frames (std::ofstream &outfile);
-   void record_cur_buffer_occupancy (std::ofstream &outfile);
-   void record_max_buffer_occupancy (std::ofstream &outfile);
-   void record_incomplete_flows (std::ofstream &outfile, int cur_tick);
+   static int phases () { return num_phases<PHASES>(); }
+   static int links () { return nodes_per_phase<NPP>() - 1; }
 
-   void add_max_buckets_in_use (std::vector<int> &buckets_in_use_vector);
-   void record_cur_buckets_in_use (std::ofstream &outfile);
-   void record_max_buckets_in_use (std::ofstream &outfile);
+   //The bucket of a buffered frame at the node it came from, which gets its token back once the frame is sent on.
+   //A frame that is being forwarded has no spray hops left there either.
+   static BucketID previous_bucket (const Packet &packet) {
+      return bucket_of(packet.dest, std::max(0, phases() - packet.hops));
+   }
 
-   ~Node();
+   static bool uses (unsigned feature) {
+      if (FEATURES != RUNTIME_FEATURES && (feature & STATIC_FEATURES)) return FEATURES & feature;
+      return features & feature;
+   }
 
-   private:
-   void await_token (PacketInfo packet_info, int send_phase, int send_link, int cur_tick);
-   void enqueue_bucket_for_sending (BucketID bucket, int send_phase, int send_link, int cur_tick);
+   //Every node of a run has the same specialization.
+   NodeImpl *neighbor (int phase, int link) { return static_cast<NodeImpl *>(adjacent_node[phase][link]); }
 
-   void receive_packet_destined_to_this_node (int cur_tick, Packet *received_packet);
+   void await_token (PacketInfo packet_info, int send_phase, int send_link);
+   void count_bucket_occupancy (BucketID bucket, int phase, int link, int delta);
+   int select_spray_link (int cur_tick, RandomPurpose purpose, int spray_phase, bool any_excluded,
+                          const int *queue_lengths, const int *bucket_counts);
+
+   void receive_packet_destined_to_this_node (int cur_tick, Packet &received_packet);
    void receive_packet_to_be_forwarded (int cur_tick, PacketInfo received_packet_info);
    void receive_packet_to_be_sprayed (int cur_tick, PacketInfo received_packet_info);
 
    void receive_rdc_destined_to_this_node (int cur_tick, RDControl received_rdc);
    void receive_rdc_to_be_forwarded (int cur_tick, RDControl received_rdc);
    void receive_rdc_to_be_sprayed (int cur_tick, RDControl received_rdc);
-public:
-   bool direct_path_has_failed_node (int phase, int link, NodeID dest_id);
 };
 
 
@@ -0,0 +1,715 @@
+#ifndef __NODE_IMPL_H
+#define __NODE_IMPL_H
+
+#include "defines.hpp"
+#include "node.hpp"
+#include "fct_log.hpp"
+#include "statistics.hpp"
+#include <climits>
+#include <cassert>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+//The stages of NodeImpl and the kernels made of them. Only the translation units that instantiate kernels include
+//this: node.cpp for the generic one, and node_kernels_<h>.cpp for those of each h, so that they compile in parallel.
+
+//Tracing of sampled frames (see node.cpp).
+uint32_t start_trace (int flow_id, int sequence_num, int cur_tick);
+void discard_trace (Packet &packet);
+void finish_trace (Packet &packet);
+
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::send_packet (int cur_tick) {
+   auto cur_phase = (cur_tick / links()) % phases();
+   auto cur_link = cur_tick % links();
+
+   //start the next flow, if needed
+   if (!failed && !send_flows.empty() && send_flows[0].start_tick <= cur_tick) {
+      statistics.change_active_flows(send_flows[0].dest_id, 1);
+      send_flows[0].credit = 1;
+      send_flows[0].credit_tick = cur_tick;
+      if (uses(FEATURE_FSR)) pin_flow_credit(send_flows[0]);
+      send_flows[0].budget = RD_STARTING_BUDGET;
+      currently_sending_flows.start(send_flows[0]);
+      send_flows.pop_front();
+   }
+
+   Packet packet_to_send = NULL_PACKET;
+
+   if (failed) {
+      //just send a NULL packet
+   } else if (link_failed[cur_phase][cur_link]) {
+      //still send a NULL packet
+      assert(send_queue[cur_phase][cur_link].empty());
+      //get rid of this assert if we want to support nodes failing during the simulation...
+   } else if (!send_queue[cur_phase][cur_link].empty()) {
+      //Send the next packet in the send queue
+      cur_enqueued_frames_per_link[cur_phase][cur_link]--;
+      cur_buffer_occupancy--;
+      statistics.change(GAUGE_BUFFERED_FRAMES, -1);
+
+      auto bucket = send_queue[cur_phase][cur_link].top_bucket();
+      Bucket &bucket_state = buckets[cur_phase][cur_link].at_slot(send_queue[cur_phase][cur_link].top_slot());
+      assert(!bucket_state.queue.empty());
+      auto &packet_info = bucket_state.queue.front();
+      packet_to_send = packet_info.packet;
+
+      //return token to original sender of packet
+      if(uses(FEATURE_HBH)) {
+         token_queue[packet_to_send.sender_phase][packet_to_send.sender_link].push_back(previous_bucket(packet_to_send));
+         pending_tokens++;
+      }
+
+      send_queue[cur_phase][cur_link].pop();
+      bucket_state.queue.pop_front();
+
+      //Spend a token if using HBH
+      if(uses(FEATURE_HBH) && bucket != DIRECT_TO_DEST_BUCKET) {
+         assert(bucket_state.num_outstanding_tokens < MAX_TOKENS_PER_BUCKET);
+         bucket_state.num_outstanding_tokens++;
+      } else {
+         count_bucket_occupancy(bucket, cur_phase, cur_link, -1);
+      }
+
+      //Re-enqueue the bucket if there are still tokens and queued frames remaining
+      if(bucket_state.num_outstanding_tokens < MAX_TOKENS_PER_BUCKET && !bucket_state.queue.empty()) {
+         enqueue_bucket_for_sending(bucket, bucket_state, cur_phase, cur_link);
+      }
+
+      //If we aren't using hop-by-hop congestion control, save memory by erasing buckets with empty queues
+      if (!uses(FEATURE_HBH) && bucket_state.queue.empty()) {
+         buckets[cur_phase][cur_link].erase(bucket);
+      }
+
+      if (packet_to_send.trace) {
+         PacketTracePool::get(packet_to_send.trace).timestamp[packet_to_send.hops] = cur_tick;
+      }
+
+   }
+   else if (!packet_retransmit_queue.empty()) {
+   //If there are any packets waiting to be retransmitted, send one of those
+      packet_to_send = packet_retransmit_queue.front();
+      packet_retransmit_queue.pop_front();
+   }
+   else if (!currently_sending_flows.empty()) {
+   //If the send queue is empty, try to generate a new packet to send
+      
+      int cursor = cur_phase * links() + cur_link;
+
+      for (int i = 0; i < currently_sending_flows.size(); i++) {
+         int position = currently_sending_flows.position(cursor);
+         Flow *flow = &currently_sending_flows.at(position);
+
+         auto dest = flow->dest_id;
+
+         //Don't send a packet for a flow if we don't have credit for it yet.
+         if (uses(FEATURE_FSR)) {
+            catch_up_flow_credit(*flow, cur_tick);
+            if (flow->credit < 1) {
+               currently_sending_flows.advance(cursor, position);
+               continue;
+            }
+         }
+         if (uses(FEATURE_RD) && flow->budget < 1) {
+            currently_sending_flows.advance(cursor, position);
+            continue;
+         }
+
+         // deal with tokens for HBH
+         // note that we don't need a token to send directly to the destination.
+         if (uses(FEATURE_HBH) && adjacent_id[cur_phase][cur_link] != dest) {
+            BucketID relevant_bucket = bucket_of(dest,phases()-1);
+            bool created;
+            Bucket &bucket_state = buckets[cur_phase][cur_link].find_or_create(relevant_bucket, created);
+            if (created) {
+               count_bucket_allocated(relevant_bucket);
+            }
+            // don't send a packet for a flow if we don't have a token for it yet.
+            if (bucket_state.num_outstanding_tokens == MAX_TOKENS_FIRSTHOP_BUCKET) {
+               currently_sending_flows.advance(cursor, position);
+               continue;
+            }
+            //If do have remaining tokens, spend a token for this packet before continuing
+            bucket_state.num_outstanding_tokens++;
+            count_bucket_occupancy(relevant_bucket, cur_phase, cur_link, 1);
+         }
+
+
+
+         packet_to_send.src = id;
+         packet_to_send.dest = flow->dest_id;
+         packet_to_send.hops = 0;
+         packet_to_send.flow_id = flow->flow_id;
+         packet_to_send.sequence_num = flow->num_frames - flow->remain_frames;
+         packet_to_send.trace = start_trace(packet_to_send.flow_id, packet_to_send.sequence_num, cur_tick);
+         if (uses(FEATURE_QUANTIZED_PRIO)) {
+            packet_to_send.flow_length = flow->quantized_num_frames;
+         } else {
+            packet_to_send.flow_length = flow->num_frames;
+         }
+
+	 sent_frames++;
+         flow->remain_frames--;
+         if (uses(FEATURE_FSR)) {
+            flow->credit--;
+         }
+         if (uses(FEATURE_RD)) {
+            flow->budget--;
+         }
+
+         if (flow->remain_frames == 0) {
+            //clean up the now-finished flow
+            statistics.change_active_flows(flow->dest_id, -1);
+            if (uses(FEATURE_FSR)) unpin_flow_credit(*flow);
+            currently_sending_flows.finish(cursor, position);
+         } else {
+            //start from the next flow next time a frame can be sent.
+            currently_sending_flows.advance(cursor, position);
+         }
+         break;
+      }
+   }
+
+   //Send packet to adjacent node.
+   //This has to be run even if there is no packet in the send queue and no packet can be generated,
+   //as even in this case a NULL packet must still be sent.
+   //A NULL packet does not need to be written: the slot is already empty.
+   if (!is_null_packet(packet_to_send)) {
+      neighbor(cur_phase, cur_link)->received_packet_queue.slot(cur_tick) = packet_to_send;
+      node_activity[adjacent_id[cur_phase][cur_link]].inbound++;
+   }
+}
+
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::receive_packet (int cur_tick) {
+   auto cur_phase = (cur_tick / links()) % phases();
+   auto cur_link = cur_tick % links();
+
+   Packet received_packet = received_packet_queue.take(cur_tick);
+
+   if (is_null_packet(received_packet)) {
+      return;
+   }
+   node_activity[id].inbound--;
+   if (failed) {
+      discard_trace(received_packet);
+      return;
+   }
+
+   received_packet.hops++;
+
+   //Check if packet is destined to this node
+   if (received_packet.dest == id) {
+      receive_packet_destined_to_this_node(cur_tick, received_packet);
+      return;
+   }
+
+   received_packet.sender_phase = cur_phase;
+   received_packet.sender_link = links() - 1 - cur_link;
+   PacketInfo received_packet_info;
+   received_packet_info.packet = received_packet;
+   received_packet_info.arrival_tick = cur_tick;
+
+   if (received_packet.hops >= phases()) {
+      //this packet is done being sprayed
+      receive_packet_to_be_forwarded(cur_tick, received_packet_info);
+      return;
+   }
+   else {
+      //this packet still needs to be sprayed
+      receive_packet_to_be_sprayed(cur_tick, received_packet_info);
+      return;
+   }
+}
+
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::receive_packet_destined_to_this_node(int cur_tick, Packet &received_packet) {
+   statistics.add(STAT_FRAMES_RECEIVED);
+
+   auto flow_id = received_packet.flow_id;
+   int slot = receive_flow_slot.find(flow_id);
+   assert(slot != FlatIndex::NOT_FOUND);
+   Flow &flow = receive_flows[slot];
+
+   flow.remain_frames--;
+
+   if (flow.remain_frames == 0) {
+      auto duration = cur_tick - flow.start_tick + PROP_DELAY_TS + 1;
+      statistics.add(STAT_COMPLETED_FLOWS);
+      if(fct_log.is_open()){
+         fct_log.append({flow_id, flow.num_frames, duration, flow.start_tick});
+      }
+      receive_flow_slot.erase(flow_id);
+      free_receive_slots.push_back(slot);
+   }
+   else if (uses(FEATURE_RD) && ((flow.num_frames - flow.remain_frames) % RD_CELLS_PER_PULL == 0)) {
+      RDControl pull_to_send;
+      pull_to_send.type = PULL;
+      pull_to_send.src = id;
+      pull_to_send.dest = flow.source_id;
+      pull_to_send.hops = 0;
+      pull_to_send.sequence_num = -1; //unused for PULL messages in this design
+      pull_to_send.flow_id = flow_id;
+      local_rdc_queue.push_back(pull_to_send);
+   }
+   finish_trace(received_packet);
+}
+
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::receive_packet_to_be_forwarded(int cur_tick, PacketInfo received_packet_info) {
+   auto cur_phase = (cur_tick / links()) % phases();
+
+   //checking phases in order, starting from the next phase, to find the first phase where the destination coordinate differs from the current node
+   for(int sending_phase_offset = 1; sending_phase_offset <= phases(); sending_phase_offset++) {
+      int sending_phase = cur_phase + sending_phase_offset;
+      if (sending_phase >= phases()) sending_phase -= phases();
+      int sending_link = routing_table.link_towards(id, received_packet_info.packet.dest, sending_phase);
+      if (sending_link < 0) {
+         //this node matches dest on the current sending phase
+         //therefore, move on to the next phase.
+         Packet &packet = received_packet_info.packet;
+         packet.hops++;
+         if (packet.trace) {
+            PacketTrace &trace = PacketTracePool::get(packet.trace);
+            trace.timestamp[packet.hops-1] = trace.timestamp[packet.hops-2];
+         }
+         continue;
+      }
+
+      assert(!link_failed[sending_phase][sending_link]);
+
+      await_token(received_packet_info, sending_phase, sending_link);
+
+      return;
+   }
+}
+
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::receive_packet_to_be_sprayed(int cur_tick, PacketInfo received_packet_info) {
+   auto cur_phase = (cur_tick / links()) % phases();
+
+   int spray_phase = (cur_phase + 1) % phases();
+
+   int rem_spray = phases() - received_packet_info.packet.hops - 1;
+   rem_spray = rem_spray < 0 ? 0 : rem_spray;
+
+   bool any_excluded = routing_table.spray_exclusions(id, spray_phase, rem_spray == 0, received_packet_info.packet.dest, spray_excluded.data());
+
+   int selected_link;
+   if (uses(FEATURE_SPRAY_SHORT)) {
+      //Spray via the shortest queue. With -B, compare the number of frames and tokens in the frame's bucket first.
+      const int *bucket_counts = NULL;
+      if (uses(FEATURE_SPRAY_BUCKET)) {
+         BucketID relevant_bucket = bucket_of(received_packet_info.packet.dest, rem_spray);
+         bucket_counts = bucket_occupancy[spray_phase].row(relevant_bucket);
+      }
+      selected_link = select_spray_link(cur_tick, RANDOM_SPRAY_FRAME, spray_phase, any_excluded, cur_enqueued_frames_per_link[spray_phase], bucket_counts);
+   } else {
+      selected_link = select_spray_link(cur_tick, RANDOM_SPRAY_FRAME, spray_phase, any_excluded, NULL, NULL);
+   }
+
+   assert(selected_link < links());
+
+   await_token(received_packet_info, spray_phase, selected_link);
+
+   return;
+}
+
+//Picks uniformly at random among the links of spray_phase with the smallest key, skipping the coordinates excluded
+//in spray_excluded (if any_excluded). The key is the link's queue length, with the bucket's count on the link
+//in the upper half if bucket_counts is given. Without queue_lengths, all keys are equal.
+//Equivalent to scanning the links in a random order and keeping the first one with the smallest key, but the keys
+//are read from contiguous arrays in loops that the compiler can vectorize, and it takes a single random draw.
+//The draw is made for purpose at cur_tick (see philox.hpp).
+template <int PHASES, int NPP, unsigned FEATURES>
+int NodeImpl<PHASES, NPP, FEATURES>::select_spray_link (int cur_tick, RandomPurpose purpose, int spray_phase, bool any_excluded,
+                                                   const int *queue_lengths, const int *bucket_counts) {
+   const int links = NodeImpl::links();
+   int64_t *keys = spray_keys.data();
+
+   if (queue_lengths == NULL) {
+      std::fill(keys, keys + links, 0);
+   } else if (bucket_counts == NULL) {
+      for (int link = 0; link < links; link++) {
+         keys[link] = queue_lengths[link];
+      }
+   } else {
+      for (int link = 0; link < links; link++) {
+         keys[link] = (int64_t)bucket_counts[link] << 32 | queue_lengths[link];
+      }
+   }
+   if (any_excluded) {
+      for (int link = 0; link < links; link++) {
+         if (RoutingTable::test(spray_excluded.data(), routing_table.coord_via(id, spray_phase, link))) {
+            keys[link] = INT64_MAX;
+         }
+      }
+   }
+
+   int64_t min_key = INT64_MAX;
+   for (int link = 0; link < links; link++) {
+      min_key = std::min(min_key, keys[link]);
+   }
+   assert(min_key != INT64_MAX);
+
+   int *ties = spray_ties.data();
+   int num_ties = 0;
+   for (int link = 0; link < links; link++) {
+      ties[num_ties] = link;
+      num_ties += keys[link] == min_key;
+   }
+   if (num_ties == 1) return ties[0];
+   return ties[random_below(random_draw(id, cur_tick, purpose), num_ties)];
+}
+
+//Keeps bucket_occupancy up to date when frames are queued in a bucket or its tokens are spent or returned.
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::count_bucket_occupancy (BucketID bucket, int phase, int link, int delta) {
+   if (!uses(FEATURE_SPRAY_SHORT) || !uses(FEATURE_SPRAY_BUCKET) || bucket == DIRECT_TO_DEST_BUCKET) return;
+   bucket_occupancy[phase].add(bucket, link, delta);
+}
+
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::send_rdc (int cur_tick) {
+   auto cur_phase = (cur_tick / links()) % phases();
+   auto cur_link = cur_tick % links();
+
+   RDControl rdc_to_send;
+   rdc_to_send.flow_id = INT_MAX;
+   rdc_to_send.type = INVALID;
+
+   catch_up_rd_pacing(cur_tick);
+
+   if (failed) {
+      //just send a NULL packet
+   } else if (link_failed[cur_phase][cur_link]) {
+      //still send a NULL packet
+      assert(rdc_send_queue[cur_phase][cur_link].empty());
+      //get rid of this assert if we want to support nodes failing during the simulation...
+   } else if (!rdc_send_queue[cur_phase][cur_link].empty()) {
+      //Send the next pull in the send queue
+      rdc_to_send = rdc_send_queue[cur_phase][cur_link].front();
+      rdc_send_queue[cur_phase][cur_link].pop_front();
+      pending_rdc--;
+   }
+   else if (!local_rdc_queue.empty() && rd_pacing_delay < 10) {
+      //If the send queue is empty, try to send a pending local pull
+      rdc_to_send = local_rdc_queue.front();
+      local_rdc_queue.pop_front();
+
+      //limit our PULL and NACK sending rate so that we don't request beyond our bandwidth guarantee
+      if (rdc_to_send.type == PULL) {
+         rd_pacing_delay += RD_CELLS_PER_PULL / RD_TARGET_BW_FACTOR;
+      } else if (rdc_to_send.type == NACK) {
+         rd_pacing_delay += 1 / RD_TARGET_BW_FACTOR;
+      }
+   }
+
+   //Send pull to adjacent node.
+   //This has to be run even if there is no packet in the send queue and no packet can be generated,
+   //as even in this case a NULL packet must still be sent.
+   if (rdc_to_send.type != INVALID) {
+      neighbor(cur_phase, cur_link)->received_rdc_queue.slot(cur_tick) = rdc_to_send;
+      node_activity[adjacent_id[cur_phase][cur_link]].inbound++;
+   }
+}
+
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::receive_rdc (int cur_tick) {
+
+   RDControl received_rdc = received_rdc_queue.take(cur_tick);
+
+   if (received_rdc.type == INVALID) {
+      return;
+   }
+   node_activity[id].inbound--;
+   if (failed) {
+      return;
+   }
+
+   received_rdc.hops++;
+
+   //Check if the pull is destined to this node
+   if (received_rdc.dest == id) {
+      receive_rdc_destined_to_this_node(cur_tick, received_rdc);
+      return;
+   }
+
+   if (received_rdc.hops >= phases()) {
+      //this rdc is done being sprayed
+      receive_rdc_to_be_forwarded(cur_tick, received_rdc);
+      return;
+   }
+   else {
+      //this rdc still needs to be sprayed
+      receive_rdc_to_be_sprayed(cur_tick, received_rdc);
+      return;
+   }
+}
+
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::receive_rdc_destined_to_this_node(int cur_tick, RDControl received_rdc) {
+   if (received_rdc.type == PULL) {
+      auto flow_id = received_rdc.flow_id;
+
+      Flow *flow = currently_sending_flows.find(flow_id);
+      if (flow) {
+         flow->budget += RD_CELLS_PER_PULL;
+      }
+   } else if (received_rdc.type == DROP) {
+      RDControl nack_to_send;
+      nack_to_send.type=NACK;
+      nack_to_send.src = id;
+      nack_to_send.dest = received_rdc.src;
+      nack_to_send.hops = 0;
+      nack_to_send.sequence_num = received_rdc.sequence_num;
+      nack_to_send.flow_id = received_rdc.flow_id;
+      local_rdc_queue.push_back(nack_to_send);
+   } else if (received_rdc.type == NACK) {
+      Packet packet_to_resend = NULL_PACKET;
+      packet_to_resend.src = id;
+      packet_to_resend.dest = received_rdc.src;
+      packet_to_resend.hops = 0;
+      packet_to_resend.flow_id = received_rdc.flow_id;
+      packet_to_resend.sequence_num = received_rdc.sequence_num;
+      packet_to_resend.trace = start_trace(packet_to_resend.flow_id, packet_to_resend.sequence_num, cur_tick);
+      packet_retransmit_queue.push_back(packet_to_resend);
+   }
+}
+
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::receive_rdc_to_be_forwarded(int cur_tick, RDControl received_rdc) {
+   auto cur_phase = (cur_tick / links()) % phases();
+
+   //checking phases in order, starting from the next phase, to find the first phase where the destination coordinate differs from the current node
+   for(int sending_phase_offset = 1; sending_phase_offset <= phases(); sending_phase_offset++) {
+      int sending_phase = cur_phase + sending_phase_offset;
+      if (sending_phase >= phases()) sending_phase -= phases();
+      int sending_link = routing_table.link_towards(id, received_rdc.dest, sending_phase);
+      if (sending_link < 0) {
+         //this node matches dest on the current sending phase
+         //therefore, move on to the next phase.
+         received_rdc.hops++;
+         continue;
+      }
+
+      assert(!link_failed[sending_phase][sending_link]);
+
+      rdc_send_queue[sending_phase][sending_link].push_back(received_rdc);
+      pending_rdc++;
+
+      return;
+   }
+}
+
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::receive_rdc_to_be_sprayed(int cur_tick, RDControl received_rdc) {
+   auto cur_phase = (cur_tick / links()) % phases();
+
+   int spray_phase = (cur_phase + 1) % phases();
+
+   int rem_spray = phases() - received_rdc.hops - 1;
+   rem_spray = rem_spray < 0 ? 0 : rem_spray;
+
+   bool any_excluded = routing_table.spray_exclusions(id, spray_phase, rem_spray == 0, received_rdc.dest, spray_excluded.data());
+   int selected_link = select_spray_link(cur_tick, RANDOM_SPRAY_RDC, spray_phase, any_excluded, NULL, NULL);
+
+   assert(selected_link < links());
+
+   rdc_send_queue[spray_phase][selected_link].push_back(received_rdc);
+   pending_rdc++;
+
+   return;
+}
+
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::send_tokens (int cur_tick) {
+   auto cur_phase = (cur_tick / links()) % phases();
+   auto cur_link = cur_tick % links();
+
+   auto &sent_tokens = neighbor(cur_phase, cur_link)->received_tokens_queue.slot(cur_tick);
+
+   if (failed) {
+      for (int i = 0; i < TOKENS_PER_PACKET; i++) {
+         sent_tokens.tokens[i] = INVALID_BUCKET;
+      }
+   }
+   else {
+      for(int i = 0; i < TOKENS_PER_PACKET; i++){
+         if (!token_queue[cur_phase][cur_link].empty()) {
+            sent_tokens.tokens[i] = token_queue[cur_phase][cur_link].front();
+            token_queue[cur_phase][cur_link].pop_front();
+            pending_tokens--;
+            node_activity[adjacent_id[cur_phase][cur_link]].inbound++;
+         } else {
+            sent_tokens.tokens[i] = INVALID_BUCKET;
+         }
+      }
+   }
+}
+
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::receive_tokens (int cur_tick) {
+   auto cur_phase = (cur_tick / links()) % phases();
+   auto recvd_link = cur_tick % links();
+   int corr_link = links() - 1 - recvd_link;
+
+   PacketTokens received_tokens = received_tokens_queue.take(cur_tick);
+   for (BucketID bucket : received_tokens.tokens) {
+      if(bucket != INVALID_BUCKET) node_activity[id].inbound--;
+   }
+
+   if (!failed) {
+      for (BucketID bucket : received_tokens.tokens) {
+         if(bucket == INVALID_BUCKET) continue;
+         Bucket &bucket_state = buckets[cur_phase][corr_link][bucket];
+         assert(bucket_state.num_outstanding_tokens > 0);
+
+         bucket_state.num_outstanding_tokens--;
+         count_bucket_occupancy(bucket, cur_phase, corr_link, -1);
+
+         if (bucket_state.num_outstanding_tokens == MAX_TOKENS_PER_BUCKET - 1 && !bucket_state.queue.empty()) {
+            enqueue_bucket_for_sending(bucket, bucket_state, cur_phase, corr_link);
+         }
+         if (bucket_state.num_outstanding_tokens == 0 && bucket_state.queue.empty()) {
+            buckets[cur_phase][corr_link].erase(bucket);
+            count_bucket_freed(bucket);
+         }
+      }
+   }
+}
+
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::await_token(PacketInfo packet_info, int send_phase, int send_link) {
+   // NOTE: await_token is called whenever we want to enqueue a packet, regardless of whether HBH is in use.
+   // The code path is identical regardless of whether or not HBH is in use. Note that in send_packet(), tokens
+   // are only spent if HBH is in use, so if HBH is not in use, the check for available tokens always succeeds.
+
+   assert(!link_failed[send_phase][send_link]);
+
+   if (uses(FEATURE_RD) && RD_MAX_QUEUE_LENGTH > 0 && cur_enqueued_frames_per_link[send_phase][send_link] >= RD_MAX_QUEUE_LENGTH) {
+      RDControl drop_to_send;
+      drop_to_send.type = DROP;
+      drop_to_send.src = packet_info.packet.src;
+      drop_to_send.dest = packet_info.packet.dest;
+      drop_to_send.hops = packet_info.packet.hops;
+      drop_to_send.sequence_num = packet_info.packet.sequence_num;
+      drop_to_send.flow_id = packet_info.packet.flow_id;
+      rdc_send_queue[send_phase][send_link].push_back(drop_to_send);
+      pending_rdc++;
+      discard_trace(packet_info.packet);
+      return;
+   }
+
+   cur_enqueued_frames_per_link[send_phase][send_link]++;
+   cur_buffer_occupancy++;
+   statistics.change(GAUGE_BUFFERED_FRAMES, 1);
+   if(cur_enqueued_frames_per_link[send_phase][send_link] > max_enqueued_frames_per_link[send_phase][send_link]) {
+      max_enqueued_frames_per_link[send_phase][send_link] = cur_enqueued_frames_per_link[send_phase][send_link];
+   }
+   if(cur_buffer_occupancy > max_buffer_occupancy) {
+      max_buffer_occupancy = cur_buffer_occupancy;
+   }
+
+   int rem_spray = phases() - packet_info.packet.hops - 1;
+   rem_spray = rem_spray < 0 ? 0 : rem_spray;
+   BucketID bucket = bucket_of(packet_info.packet.dest, rem_spray);
+
+   //Tokens aren't needed when sending directly to the destination, so we have a special bucket for this case.
+   if (adjacent_id[send_phase][send_link] == packet_info.packet.dest) {
+      bucket = DIRECT_TO_DEST_BUCKET;
+   }
+
+   bool created;
+   Bucket &bucket_state = buckets[send_phase][send_link].find_or_create(bucket, created);
+   if (created && uses(FEATURE_HBH) && bucket != DIRECT_TO_DEST_BUCKET) {
+      count_bucket_allocated(bucket);
+   }
+
+   //Add the packet to the bucket's queue
+   bucket_state.queue.push_back(packet_info);
+   count_bucket_occupancy(bucket, send_phase, send_link, 1);
+
+   //If the bucket has available tokens, we need to make sure it is in the send queue with the correct priority.
+   //If this is the first packet in this bucket, we need to add the bucket to the send queue.
+   //Otherwise, if there are already packets in the bucket, the bucket must already be in the send queue.
+   //Packets are appended at the back, so the head of the bucket (which sets its priority) is unchanged.
+   if(bucket == DIRECT_TO_DEST_BUCKET || bucket_state.num_outstanding_tokens < MAX_TOKENS_PER_BUCKET) {
+      if (bucket_state.queue.size() == 1) {
+         enqueue_bucket_for_sending(bucket, bucket_state, send_phase, send_link);
+      }
+   }
+}
+
+//The send stages of a node only write to its own state and to its neighbours' mailboxes, so they are run back to back
+//for each node. Nodes that are not awake yet would only send empty slots, so they are skipped. Nodes with flows are
+//always awake.
+template <int PHASES, int NPP, unsigned FEATURES>
+bool NodeImpl<PHASES, NPP, FEATURES>::send_stages (Node *const *nodes, int begin, int end, int send_tick,
+                                                   bool send_tokens) {
+   bool sent = false;
+   for (int i = begin; i < end; i++) {
+      if (node_activity[i].wake_tick > send_tick) continue;
+      NodeImpl *node = static_cast<NodeImpl *>(nodes[i]);
+      node->send_packet(send_tick);
+      if (uses(FEATURE_RD)) node->send_rdc(send_tick);
+      if (send_tokens) node->send_tokens(send_tick);
+      node->update_wake_tick();
+      sent = true;
+   }
+   return sent;
+}
+
+//Likewise, the receive stages of a node only touch its own state. Nodes with nothing on its way to them would only
+//receive empty slots.
+template <int PHASES, int NPP, unsigned FEATURES>
+void NodeImpl<PHASES, NPP, FEATURES>::receive_stages (Node *const *nodes, int begin, int end, int receive_tick,
+                                                      bool receive_tokens) {
+   for (int i = begin; i < end; i++) {
+      if (node_activity[i].inbound == 0) continue;
+      NodeImpl *node = static_cast<NodeImpl *>(nodes[i]);
+      node->receive_packet(receive_tick);
+      if (uses(FEATURE_RD)) node->receive_rdc(receive_tick);
+      if (receive_tokens) node->receive_tokens(receive_tick);
+      node->update_wake_tick();
+   }
+}
+
+template <int PHASES, int NPP, unsigned FEATURES>
+constexpr NodeKernel kernel_of () {
+   typedef NodeImpl<PHASES, NPP, FEATURES> Impl;
+   return {&Impl::create, &Impl::send_stages, &Impl::receive_stages, PHASES, NPP};
+}
+
+//The sets of STATIC_FEATURES, which are the lowest feature bits so that every set is its own index.
+static_assert((STATIC_FEATURES & (STATIC_FEATURES + 1)) == 0, "STATIC_FEATURES must be the lowest feature bits");
+typedef std::make_integer_sequence<unsigned, STATIC_FEATURES + 1> StaticFeatureSets;
+
+template <int PHASES, int NPP, unsigned... FEATURES>
+const NodeKernel &kernel_for (unsigned features, std::integer_sequence<unsigned, FEATURES...>) {
+   static const NodeKernel kernels[] = {kernel_of<PHASES, NPP, FEATURES>()...};
+   return kernels[features];
+}
+
+//For each h, the NODES_PER_PHASE for which the kernels are also specialized (0 = none): those of the 10000-node runs
+//of the paper's test cases. Other sizes use the kernels specialized on h alone.
+constexpr int SPECIALIZED_NODES_PER_PHASE[MAX_PHASES+1] = {0, 0, 100, 22, 10};
+
+template <int PHASES>
+const NodeKernel &kernel_for_phases (unsigned features) {
+   constexpr int NPP = SPECIALIZED_NODES_PER_PHASE[PHASES];
+   if constexpr (NPP > 0) {
+      if (NODES_PER_PHASE == NPP) return kernel_for<PHASES, NPP>(features, StaticFeatureSets());
+   }
+   return kernel_for<PHASES, 0>(features, StaticFeatureSets());
+}
+
+//Instantiated in node_kernels_<h>.cpp.
+extern template const NodeKernel &kernel_for_phases<2> (unsigned features);
+extern template const NodeKernel &kernel_for_phases<3> (unsigned features);
+extern template const NodeKernel &kernel_for_phases<4> (unsigned features);
+
+#endif
@@ -0,0 +1,3 @@
+#include "node_impl.hpp"
+
+template const NodeKernel &kernel_for_phases<2> (unsigned features);
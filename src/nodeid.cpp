@@ -20,30 +20,6 @@ NodeID node_id_from_array(int *coords){
    return id;
 }
 
-int extract_coord(NodeID id, int phase){
-   int node_id = id.id;
-   for(int i = 0; i < phase; i++){
-      node_id /= NODES_PER_PHASE;
-   }
-   return node_id % NODES_PER_PHASE;
-}
-
-NodeID adjust_coord(NodeID id, int phase, int offset){
-   int coords[NUM_PHASES];
-   fill_array_with_coords(coords, id);
-   coords[phase] += offset;
-   coords[phase] %= NODES_PER_PHASE;
-   return node_id_from_array(coords);
-}
-
-NodeID set_coord(NodeID id, int phase, int value){
-   int coords[NUM_PHASES];
-   fill_array_with_coords(coords, id);
-   coords[phase] = value;
-   coords[phase] %= NODES_PER_PHASE;
-   return node_id_from_array(coords);
-}
-
 BucketID bucket_of(NodeID id, int rem_spray_hops){
    auto node_id = id.id;
    BucketID bucketid;
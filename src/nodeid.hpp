@@ -3,6 +3,22 @@
 
 #include <iostream>
 extern int MAX_NODE_ID;
+extern int NUM_PHASES;
+extern int NODES_PER_PHASE;
+
+#define MAX_PHASES 4
+
+//PHASES if the number of phases is known at compile time (see NodeImpl), NUM_PHASES if it is 0.
+template <int PHASES = 0>
+inline int num_phases () {
+   return PHASES > 0 ? PHASES : NUM_PHASES;
+}
+
+//Likewise, NPP or NODES_PER_PHASE.
+template <int NPP = 0>
+inline int nodes_per_phase () {
+   return NPP > 0 ? NPP : NODES_PER_PHASE;
+}
 
 typedef struct NodeID {
    int id;
@@ -21,13 +37,11 @@ typedef struct BucketID {
    }
 } BucketID;
 
-int extract_coord(NodeID id, int phase);
-NodeID adjust_coord(NodeID id, int phase, int offset);
-NodeID set_coord(NodeID id, int phase, int value);
-BucketID bucket_of(NodeID id, int rem_spray_hops);
-
+void fill_array_with_coords(int *coords, NodeID id);
 NodeID node_id_from_array(int *coords);
 
+BucketID bucket_of(NodeID id, int rem_spray_hops);
+
 std::ostream& operator<<(std::ostream &strm, const NodeID id);
 std::ostream& operator<<(std::ostream &strm, const BucketID id);
 
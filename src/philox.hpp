@@ -0,0 +1,56 @@
+#ifndef __PHILOX_H
+#define __PHILOX_H
+
+#include <cstdint>
+
+extern uint64_t RANDOM_SEED;
+
+//Philox4x32-10, the counter-based generator of Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3".
+//Each output block is a pure function of a 128-bit counter and a 64-bit key, so a draw needs no generator state,
+//and does not depend on which thread makes it or in what order.
+class Philox4x32 {
+   static const uint32_t M0 = 0xD2511F53;
+   static const uint32_t M1 = 0xCD9E8D57;
+   static const uint32_t W0 = 0x9E3779B9;
+   static const uint32_t W1 = 0xBB67AE85;
+
+   public:
+   typedef struct {
+      uint32_t v[4];
+   } Block;
+
+   static Block generate (Block counter, uint64_t key) {
+      uint32_t k0 = (uint32_t)key;
+      uint32_t k1 = (uint32_t)(key >> 32);
+      for (int round = 0; round < 10; round++) {
+         uint64_t p0 = (uint64_t)M0 * counter.v[0];
+         uint64_t p1 = (uint64_t)M1 * counter.v[2];
+         counter = {{(uint32_t)(p1 >> 32) ^ counter.v[1] ^ k0, (uint32_t)p1,
+                     (uint32_t)(p0 >> 32) ^ counter.v[3] ^ k1, (uint32_t)p0}};
+         k0 += W0;
+         k1 += W1;
+      }
+      return counter;
+   }
+};
+
+//What a random draw is used for. A node makes at most one draw per purpose and tick, and draws for different
+//purposes are independent.
+typedef enum {
+   RANDOM_SPRAY_FRAME, //picking the link to spray a received frame to
+   RANDOM_SPRAY_RDC,   //picking the link to spray a received RDC message to
+   RANDOM_WORKLOAD_FLOW,    //start, size and destination of a synthetic flow (drawn with the workload seed)
+   RANDOM_WORKLOAD_PATTERN, //the pairs or receivers of a synthetic traffic pattern (drawn with the workload seed)
+} RandomPurpose;
+
+//A uniformly distributed 32-bit value, determined by the seed, the node, the tick and the purpose.
+inline uint32_t random_draw (int node, int tick, RandomPurpose purpose) {
+   return Philox4x32::generate({{(uint32_t)tick, (uint32_t)node, (uint32_t)purpose, 0}}, RANDOM_SEED).v[0];
+}
+
+//Maps a draw to [0, n) by multiplying and shifting (n is tiny compared to 2^32, so the bias is negligible).
+inline int random_below (uint32_t draw, int n) {
+   return (int)((uint64_t)draw * n >> 32);
+}
+
+#endif
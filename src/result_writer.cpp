@@ -0,0 +1,259 @@
+#include "result_writer.hpp"
+#include "defines.hpp"
+#include <iostream>
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+const char RESULT_MAGIC[8] = {'R', 'E', 'S', 'U', 'L', 'T', 'v', '1'};
+
+void put_u32 (std::vector<char> &out, uint32_t value) {
+   char bytes[4];
+   std::memcpy(bytes, &value, 4);
+   out.insert(out.end(), bytes, bytes + 4);
+}
+
+void put_varint (std::vector<char> &out, uint64_t value) {
+   while (value >= 0x80) {
+      out.push_back((char)(value | 0x80));
+      value >>= 7;
+   }
+   out.push_back((char)value);
+}
+
+//Moves negative differences next to positive ones, so that small differences of either sign take few bytes.
+uint64_t zigzag (int64_t value) {
+   return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+int64_t unzigzag (uint64_t value) {
+   return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+[[noreturn]] void malformed (const std::filesystem::path &path) {
+   std::cerr << "Error: " << path << " is not a valid result table" << std::endl;
+   exit(EXIT_FAILURE);
+}
+
+//Reads a binary table out of memory, failing on anything past its end.
+class TableReader {
+   const std::vector<char> &data;
+   const std::filesystem::path &path;
+   size_t pos = 0;
+
+   public:
+   TableReader (const std::vector<char> &data, const std::filesystem::path &path) : data(data), path(path) {}
+
+   bool done () const { return pos == data.size(); }
+
+   const char *take (size_t length) {
+      if (data.size() - pos < length) malformed(path);
+      const char *bytes = data.data() + pos;
+      pos += length;
+      return bytes;
+   }
+
+   uint32_t u32 () {
+      uint32_t value;
+      std::memcpy(&value, take(4), 4);
+      return value;
+   }
+};
+
+void decode_column (const char *bytes, size_t length, ResultFormat format, std::vector<int64_t> &column,
+                    const std::filesystem::path &path) {
+   if (format == RESULTS_BINARY) {
+      if (length != column.size() * sizeof(int64_t)) malformed(path);
+      std::memcpy(column.data(), bytes, length);
+      return;
+   }
+   const char *end = bytes + length;
+   int64_t value = 0;
+   for (int64_t &entry : column) {
+      uint64_t encoded = 0;
+      int shift = 0;
+      while (true) {
+         if (bytes == end || shift > 63) malformed(path);
+         uint8_t byte = *bytes++;
+         encoded |= (uint64_t)(byte & 0x7f) << shift;
+         shift += 7;
+         if (!(byte & 0x80)) break;
+      }
+      value += unzigzag(encoded);
+      entry = value;
+   }
+   if (bytes != end) malformed(path);
+}
+
+void convert_table (const std::filesystem::path &path, std::ostream &log) {
+   std::FILE *in = std::fopen(path.c_str(), "rb");
+   if (!in) {
+      std::cerr << "Error: could not open file " << path << std::endl;
+      exit(EXIT_FAILURE);
+   }
+   std::vector<char> data(std::filesystem::file_size(path));
+   if (std::fread(data.data(), 1, data.size(), in) != data.size()) malformed(path);
+   std::fclose(in);
+
+   TableReader reader(data, path);
+   if (std::memcmp(reader.take(sizeof(RESULT_MAGIC)), RESULT_MAGIC, sizeof(RESULT_MAGIC)) != 0) malformed(path);
+   ResultFormat format = (ResultFormat)reader.u32();
+   if (format != RESULTS_BINARY && format != RESULTS_PACKED) malformed(path);
+   //node columns are written with the run's coordinates
+   NUM_PHASES = reader.u32();
+   NODES_PER_PHASE = reader.u32();
+   std::vector<ResultColumn> column_specs(reader.u32());
+   for (ResultColumn &spec : column_specs) {
+      spec.is_node = reader.u32();
+      uint32_t length = reader.u32();
+      spec.name.assign(reader.take(length), length);
+   }
+
+   std::filesystem::path csv_path = path;
+   csv_path.replace_extension(".csv");
+   ResultWriter csv;
+   csv.open(csv_path, column_specs, RESULTS_CSV);
+   std::vector<std::vector<int64_t>> columns(column_specs.size());
+   size_t num_rows = 0;
+   while (!reader.done()) {
+      uint32_t rows = reader.u32();
+      for (auto &column : columns) {
+         column.resize(rows);
+         uint32_t length = reader.u32();
+         decode_column(reader.take(length), length, format, column, path);
+      }
+      std::vector<int64_t> values(columns.size());
+      for (uint32_t row = 0; row < rows; row++) {
+         for (size_t c = 0; c < columns.size(); c++) values[c] = columns[c][row];
+         csv.row(values.data());
+      }
+      num_rows += rows;
+   }
+   csv.close();
+   log << "Wrote " << num_rows << " rows to " << csv_path << std::endl;
+}
+
+}
+
+std::filesystem::path ResultWriter::path_for (const std::filesystem::path &csv_path, ResultFormat format) {
+   if (format == RESULTS_CSV) return csv_path;
+   std::filesystem::path binary_path = csv_path;
+   return binary_path.replace_extension(".res");
+}
+
+void ResultWriter::open (const std::filesystem::path &csv_path, const std::vector<ResultColumn> &column_specs,
+                         ResultFormat format) {
+   close();
+   path = path_for(csv_path, format);
+   file = std::fopen(path.c_str(), "wb");
+   if (!file) {
+      std::cerr << "Error: could not open file " << path << " for writing" << std::endl;
+      exit(EXIT_FAILURE);
+   }
+   this->format = format;
+   num_columns = column_specs.size();
+   is_node.clear();
+   for (const ResultColumn &spec : column_specs) is_node.push_back(spec.is_node);
+   buffer.clear();
+   buffer.reserve(BUFFER_SIZE + 4096);
+   if (format == RESULTS_CSV) return;
+
+   buffer.insert(buffer.end(), RESULT_MAGIC, RESULT_MAGIC + sizeof(RESULT_MAGIC));
+   put_u32(buffer, format);
+   put_u32(buffer, NUM_PHASES);
+   put_u32(buffer, NODES_PER_PHASE);
+   put_u32(buffer, num_columns);
+   for (const ResultColumn &spec : column_specs) {
+      put_u32(buffer, spec.is_node);
+      put_u32(buffer, spec.name.size());
+      buffer.insert(buffer.end(), spec.name.begin(), spec.name.end());
+   }
+   columns.assign(num_columns, {});
+   for (auto &column : columns) column.reserve(CHUNK_ROWS);
+}
+
+void ResultWriter::row (const int64_t *values) {
+   if (format != RESULTS_CSV) {
+      for (int c = 0; c < num_columns; c++) columns[c].push_back(values[c]);
+      if (columns[0].size() == CHUNK_ROWS) write_chunk();
+      return;
+   }
+   size_t start = buffer.size();
+   buffer.resize(start + num_columns * (21 + 12 * NUM_PHASES));
+   char *end = buffer.data() + start;
+   for (int c = 0; c < num_columns; c++) {
+      if (c > 0) *end++ = ',';
+      if (!is_node[c]) {
+         end = std::to_chars(end, buffer.data() + buffer.size(), values[c]).ptr;
+         continue;
+      }
+      //as operator<< (NodeID) writes it
+      int64_t node = values[c];
+      *end++ = '[';
+      for (int phase = 0; phase < NUM_PHASES; phase++) {
+         if (phase > 0) *end++ = ' ';
+         end = std::to_chars(end, buffer.data() + buffer.size(), node % NODES_PER_PHASE).ptr;
+         node /= NODES_PER_PHASE;
+      }
+      *end++ = ']';
+   }
+   *end++ = '\n';
+   buffer.resize(end - buffer.data());
+   if (buffer.size() >= BUFFER_SIZE) write_buffer();
+}
+
+void ResultWriter::close () {
+   if (!file) return;
+   if (format != RESULTS_CSV && !columns[0].empty()) write_chunk();
+   write_buffer();
+   std::fclose(file);
+   file = NULL;
+}
+
+void ResultWriter::write_chunk () {
+   put_u32(buffer, columns[0].size());
+   for (auto &column : columns) {
+      size_t length_at = buffer.size();
+      put_u32(buffer, 0);
+      if (format == RESULTS_BINARY) {
+         const char *bytes = (const char *)column.data();
+         buffer.insert(buffer.end(), bytes, bytes + column.size() * sizeof(int64_t));
+      } else {
+         int64_t previous = 0;
+         for (int64_t value : column) {
+            put_varint(buffer, zigzag(value - previous));
+            previous = value;
+         }
+      }
+      uint32_t length = buffer.size() - length_at - 4;
+      std::memcpy(&buffer[length_at], &length, 4);
+      column.clear();
+   }
+   if (buffer.size() >= BUFFER_SIZE) write_buffer();
+}
+
+void ResultWriter::write_buffer () {
+   if (std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+      std::cerr << "Error: could not write to " << path << std::endl;
+      exit(EXIT_FAILURE);
+   }
+   buffer.clear();
+}
+
+void convert_results (const std::filesystem::path &path, std::ostream &log) {
+   if (!std::filesystem::is_directory(path)) {
+      convert_table(path, log);
+      return;
+   }
+   std::vector<std::filesystem::path> tables;
+   for (const auto &entry : std::filesystem::directory_iterator(path)) {
+      if (entry.is_regular_file() && entry.path().extension() == ".res") tables.push_back(entry.path());
+   }
+   std::sort(tables.begin(), tables.end());
+   for (const auto &table : tables) {
+      convert_table(table, log);
+   }
+}
@@ -0,0 +1,79 @@
+#ifndef __RESULT_WRITER_H
+#define __RESULT_WRITER_H
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <initializer_list>
+#include <ostream>
+#include <string>
+#include <vector>
+
+//How result tables (fct.csv, the snapshots, ...) are written.
+typedef enum {
+   RESULTS_CSV,    //one line of comma-separated integers per row
+   RESULTS_BINARY, //chunks of raw 64-bit columns
+   RESULTS_PACKED, //chunks of columns of zigzag varints, each the difference from the value in the row before
+} ResultFormat;
+
+extern ResultFormat RESULT_FORMAT;
+
+typedef struct {
+   std::string name;
+   bool is_node; //a node ID, written to CSV as the node's coordinates, like "[1 0 3]"
+} ResultColumn;
+
+//Writes a table of integers, buffering it in memory and writing it in large pieces, without ever flushing.
+//A binary table is a header (RESULT_MAGIC, the format, NUM_PHASES and NODES_PER_PHASE, and the columns), followed
+//by chunks of up to CHUNK_ROWS rows: the number of rows (uint32), then for each column the length of its data in bytes (uint32) and the data.
+//convert_results turns binary tables back into the CSV files they stand for.
+class ResultWriter {
+   static const size_t BUFFER_SIZE = 1 << 20; //bytes
+   static const int CHUNK_ROWS = 1 << 16;
+
+   std::FILE *file = NULL;
+   std::filesystem::path path;
+   ResultFormat format;
+   int num_columns;
+   std::vector<bool> is_node;
+   std::vector<char> buffer;
+   std::vector<std::vector<int64_t>> columns; //rows of the current chunk, for the binary formats
+
+   public:
+   ResultWriter () {}
+   ResultWriter (const ResultWriter &) = delete;
+   ResultWriter &operator= (const ResultWriter &) = delete;
+   ~ResultWriter () { close(); }
+
+   //Where a table that would be csv_path as CSV is written in format: csv_path, or for the binary formats, csv_path
+   //with the extension .res.
+   static std::filesystem::path path_for (const std::filesystem::path &csv_path, ResultFormat format = RESULT_FORMAT);
+
+   //Creates path_for(csv_path, format). Exits with an error message if the file cannot be created.
+   void open (const std::filesystem::path &csv_path, const std::vector<ResultColumn> &columns,
+              ResultFormat format = RESULT_FORMAT);
+
+   bool is_open () const { return file != NULL; }
+
+   //values must have one value per column.
+   void row (const int64_t *values);
+
+   void row (std::initializer_list<int64_t> values) {
+      assert((int)values.size() == num_columns);
+      row(values.begin());
+   }
+
+   //Writes whatever is buffered and closes the file, if it is open.
+   void close ();
+
+   private:
+   void write_chunk ();
+   void write_buffer ();
+};
+
+//Writes the CSV file for the binary table at path, or for every binary table in the directory at path, next to it.
+//Exits with an error message if a table cannot be read.
+void convert_results (const std::filesystem::path &path, std::ostream &log);
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef __ROUTING_TABLE_H
+#define __ROUTING_TABLE_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "defines.hpp"
+
+//Every node's coordinates and the stride of each phase in node IDs, computed once at startup, so that routing
+//needs no divisions by NODES_PER_PHASE.
+//A node's link l in phase p goes to the node whose coordinate in phase p is l+1 higher (mod NODES_PER_PHASE).
+//
+//It also tracks failed nodes by line: the nodes that differ only in their coordinate in a given phase (and so are
+//linked to each other in that phase) form a line, and each line has a bitmask of its failed nodes' coordinates.
+class RoutingTable {
+   std::vector<int> coords; //[node][phase], rows padded to MAX_PHASES
+   std::vector<int> lines;  //[node][phase], rows padded to MAX_PHASES
+   int64_t stride[MAX_PHASES+1]; //64-bit, so that the last one, NODES_PER_PHASE^NUM_PHASES, cannot overflow
+   int nodes_per_phase;
+   int lines_per_phase;
+   int words_per_mask;
+   std::vector<uint64_t> failed_in_line; //[phase][line][word]
+   bool any_failed;
+
+   public:
+   //Must be called once NUM_PHASES and NODES_PER_PHASE are known.
+   void build (int num_nodes) {
+      nodes_per_phase = NODES_PER_PHASE;
+      stride[0] = 1;
+      for (int phase = 1; phase <= NUM_PHASES; phase++) {
+         stride[phase] = stride[phase-1] * NODES_PER_PHASE;
+      }
+      coords.assign((size_t)num_nodes * MAX_PHASES, 0);
+      lines.assign((size_t)num_nodes * MAX_PHASES, 0);
+      for (int node = 0; node < num_nodes; node++) {
+         fill_array_with_coords(&coords[(size_t)node * MAX_PHASES], NodeID{node});
+         for (int phase = 0; phase < NUM_PHASES; phase++) {
+            lines[(size_t)node * MAX_PHASES + phase] = (int)(node / stride[phase+1] * stride[phase] + node % stride[phase]);
+         }
+      }
+
+      lines_per_phase = num_nodes / NODES_PER_PHASE;
+      words_per_mask = (NODES_PER_PHASE + 63) / 64;
+      failed_in_line.assign((size_t)NUM_PHASES * lines_per_phase * words_per_mask, 0);
+      any_failed = false;
+   }
+
+   void mark_failed (NodeID id) {
+      for (int phase = 0; phase < NUM_PHASES; phase++) {
+         int c = coord(id, phase);
+         line_mask(phase, id)[c / 64] |= (uint64_t)1 << (c % 64);
+      }
+      any_failed = true;
+   }
+
+   //Length of the coordinate masks, in 64-bit words.
+   int mask_words () const { return words_per_mask; }
+
+   static bool test (const uint64_t *mask, int c) {
+      return mask[c / 64] >> (c % 64) & 1;
+   }
+
+   int coord (NodeID id, int phase) const {
+      return coords[(size_t)id.id * MAX_PHASES + phase];
+   }
+
+   //id with its coordinate in phase replaced by value.
+   NodeID with_coord (NodeID id, int phase, int value) const {
+      return NodeID{(int)(id.id + (value - coord(id, phase)) * stride[phase])};
+   }
+
+   //The node at the other end of id's link in phase.
+   NodeID neighbor (NodeID id, int phase, int link) const {
+      return with_coord(id, phase, coord_via(id, phase, link));
+   }
+
+   //Coordinate in phase of the node at the other end of id's link in that phase.
+   int coord_via (NodeID id, int phase, int link) const {
+      int value = coord(id, phase) + link + 1;
+      if (value >= nodes_per_phase) value -= nodes_per_phase;
+      return value;
+   }
+
+   //Fills excluded (mask_words() words) with the coordinates in phase that a frame at id must not be sprayed to:
+   //those of failed nodes and, on the last spray hop, those from which the direct path to dest (which fixes the
+   //coordinates of the following phases one by one) passes through a failed node.
+   //Returns false without touching excluded if no node has failed.
+   bool spray_exclusions (NodeID id, int phase, bool last_spray_hop, NodeID dest, uint64_t *excluded) const {
+      if (!any_failed) return false;
+      const uint64_t *own_line = line_mask(phase, id);
+      std::copy(own_line, own_line + words_per_mask, excluded);
+      if (last_spray_hop) {
+         //The nodes on the path from any coordinate in phase only differ in that coordinate, so each step of the
+         //path is covered by one line.
+         NodeID cur = id;
+         int path_phase = phase;
+         for (int step = 1; step < NUM_PHASES; step++) {
+            path_phase++;
+            if (path_phase == NUM_PHASES) path_phase = 0;
+            cur = with_coord(cur, path_phase, coord(dest, path_phase));
+            const uint64_t *path_line = line_mask(phase, cur);
+            for (int word = 0; word < words_per_mask; word++) {
+               excluded[word] |= path_line[word];
+            }
+         }
+      }
+      return true;
+   }
+
+   //The link in phase that takes a frame at id to dest's coordinate in that phase, or -1 if they already match.
+   int link_towards (NodeID id, NodeID dest, int phase) const {
+      int offset = coord(dest, phase) - coord(id, phase);
+      if (offset == 0) return -1;
+      if (offset < 0) offset += nodes_per_phase;
+      return offset - 1;
+   }
+
+   private:
+   //Failed nodes of id's line in phase.
+   uint64_t *line_mask (int phase, NodeID id) {
+      return &failed_in_line[((size_t)phase * lines_per_phase + lines[(size_t)id.id * MAX_PHASES + phase]) * words_per_mask];
+   }
+
+   const uint64_t *line_mask (int phase, NodeID id) const {
+      return &failed_in_line[((size_t)phase * lines_per_phase + lines[(size_t)id.id * MAX_PHASES + phase]) * words_per_mask];
+   }
+};
+
+extern RoutingTable routing_table;
+
+#endif
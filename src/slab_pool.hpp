@@ -0,0 +1,151 @@
+#ifndef __SLAB_POOL_H
+#define __SLAB_POOL_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//Pool for small objects that are created and destroyed at a high rate, often on different threads
+//(a frame is created by its source's worker and freed by its destination's).
+//Each thread keeps its own cache of free objects, so allocating and freeing normally takes no locks. A thread that
+//frees more than it allocates hands whole magazines of objects to a shared depot, where threads that run dry pick
+//them up. New objects are carved out of slabs, which are only given back at exit.
+//Objects are named by 32-bit handles instead of pointers, so that the records that refer to them stay small.
+//0 is never a handle.
+template <typename T>
+class SlabPool {
+   static const int MAGAZINE_SIZE = 256;
+   static const int SLAB_BITS = 12;
+   static const uint32_t SLAB_SIZE = 1 << SLAB_BITS;
+   static const uint32_t MAX_SLABS = 1 << 16;
+
+   struct alignas(64) ThreadCache {
+      std::vector<uint32_t> free_objects;
+      long allocated = 0;
+      long released = 0;
+   };
+
+   //Hands the calling thread's cache back to the pool when the thread exits, so that a later thread can adopt it.
+   struct CacheHandle {
+      ThreadCache *cache = NULL;
+      ~CacheHandle () {
+         if (cache) retire(cache);
+      }
+   };
+
+   struct Shared {
+      std::mutex mutex;
+      std::vector<std::unique_ptr<T[]>> slabs;
+      std::vector<std::vector<uint32_t>> magazines;
+      std::vector<std::unique_ptr<ThreadCache>> caches;
+      std::vector<ThreadCache *> idle_caches;
+   };
+
+   static inline thread_local CacheHandle handle;
+   //By slab number. Entries are only ever added, so a thread can read the slab of any handle it was given.
+   static inline T *slab_table[MAX_SLABS];
+
+   public:
+   //A value-initialized object, like new T().
+   static uint32_t allocate () {
+      ThreadCache &cache = local_cache();
+      if (cache.free_objects.empty()) refill(cache);
+      uint32_t object = cache.free_objects.back();
+      cache.free_objects.pop_back();
+      cache.allocated++;
+      get(object) = T();
+      return object;
+   }
+
+   static void release (uint32_t object) {
+      ThreadCache &cache = local_cache();
+      cache.free_objects.push_back(object);
+      cache.released++;
+      if (cache.free_objects.size() >= 2 * MAGAZINE_SIZE) flush(cache);
+   }
+
+   static T &get (uint32_t object) {
+      uint32_t index = object - 1;
+      return slab_table[index >> SLAB_BITS][index & (SLAB_SIZE - 1)];
+   }
+
+   //The statistics below sum over every thread's cache, so they must only be called while no other thread
+   //is using the pool (e.g. while the workers are parked at a barrier).
+   static long live () {
+      Shared &pool = shared();
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      long live = 0;
+      for (auto &cache : pool.caches) {
+         live += cache->allocated - cache->released;
+      }
+      return live;
+   }
+
+   static long reserved_bytes () {
+      Shared &pool = shared();
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      return (long)pool.slabs.size() * SLAB_SIZE * sizeof(T);
+   }
+
+   private:
+   static Shared &shared () {
+      static Shared pool;
+      return pool;
+   }
+
+   static ThreadCache &local_cache () {
+      if (!handle.cache) handle.cache = adopt();
+      return *handle.cache;
+   }
+
+   static ThreadCache *adopt () {
+      Shared &pool = shared();
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      if (!pool.idle_caches.empty()) {
+         ThreadCache *cache = pool.idle_caches.back();
+         pool.idle_caches.pop_back();
+         return cache;
+      }
+      pool.caches.emplace_back(new ThreadCache());
+      return pool.caches.back().get();
+   }
+
+   static void retire (ThreadCache *cache) {
+      Shared &pool = shared();
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      pool.idle_caches.push_back(cache);
+   }
+
+   static void refill (ThreadCache &cache) {
+      Shared &pool = shared();
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      if (!pool.magazines.empty()) {
+         cache.free_objects.swap(pool.magazines.back());
+         pool.magazines.pop_back();
+         return;
+      }
+      if (pool.slabs.size() == MAX_SLABS) {
+         std::cerr << "Error: more than " << (uint64_t)MAX_SLABS * SLAB_SIZE << " pooled objects are in use" << std::endl;
+         exit(EXIT_FAILURE);
+      }
+      uint32_t first = pool.slabs.size() * SLAB_SIZE + 1;
+      pool.slabs.emplace_back(new T[SLAB_SIZE]);
+      slab_table[pool.slabs.size() - 1] = pool.slabs.back().get();
+      for (int i = SLAB_SIZE - 1; i >= 0; i--) {
+         cache.free_objects.push_back(first + i);
+      }
+   }
+
+   static void flush (ThreadCache &cache) {
+      std::vector<uint32_t> magazine(cache.free_objects.end() - MAGAZINE_SIZE, cache.free_objects.end());
+      cache.free_objects.resize(cache.free_objects.size() - MAGAZINE_SIZE);
+      Shared &pool = shared();
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      pool.magazines.push_back(std::move(magazine));
+   }
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "snapshot_writer.hpp"
+#include "defines.hpp"
+#include "node.hpp"
+#include "result_writer.hpp"
+#include <string>
+
+void SnapshotWriter::open (const std::filesystem::path &output_dir) {
+   this->output_dir = output_dir;
+   stopping = false;
+   writer = std::thread(&SnapshotWriter::write_snapshots, this);
+}
+
+std::unique_ptr<Snapshot> SnapshotWriter::acquire (int tick, int num_nodes, bool with_buckets) {
+   std::unique_ptr<Snapshot> snapshot;
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!spare.empty()) {
+         snapshot = std::move(spare.back());
+         spare.pop_back();
+      }
+   }
+   if (!snapshot) snapshot = std::make_unique<Snapshot>();
+   snapshot->tick = tick;
+   snapshot->buffer_occupancy.resize(num_nodes);
+   snapshot->buckets_in_use.resize(with_buckets ? num_nodes : 0);
+   return snapshot;
+}
+
+void SnapshotWriter::submit (std::unique_ptr<Snapshot> snapshot) {
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.push_back(std::move(snapshot));
+   }
+   submitted.notify_one();
+}
+
+void SnapshotWriter::close () {
+   if (!writer.joinable()) return;
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+   }
+   submitted.notify_one();
+   writer.join();
+}
+
+void SnapshotWriter::write_snapshots () {
+   std::unique_lock<std::mutex> lock(mutex);
+   while (true) {
+      submitted.wait(lock, [this]{ return stopping || !queue.empty(); });
+      if (queue.empty()) return;
+      std::unique_ptr<Snapshot> snapshot = std::move(queue.front());
+      queue.pop_front();
+      lock.unlock();
+      write(*snapshot);
+      lock.lock();
+      spare.push_back(std::move(snapshot));
+   }
+}
+
+//Same rows as Node::record_cur_buckets_in_use and Node::record_cur_buffer_occupancy.
+void SnapshotWriter::write (const Snapshot &snapshot) {
+   std::string suffix = "-" + std::to_string(snapshot.tick) + ".csv";
+   if (!snapshot.buckets_in_use.empty()) {
+      ResultWriter active_buckets_table;
+      active_buckets_table.open(output_dir / ("active-buckets" + suffix), Node::NODE_COLUMNS);
+      for (int node = 0; node < (int)snapshot.buckets_in_use.size(); node++) {
+         if (!is_failed_node[node]) active_buckets_table.row({node, snapshot.buckets_in_use[node]});
+      }
+   }
+   ResultWriter buffer_occupancy_table;
+   buffer_occupancy_table.open(output_dir / ("buffer-occupancy" + suffix), Node::NODE_COLUMNS);
+   for (int node = 0; node < (int)snapshot.buffer_occupancy.size(); node++) {
+      if (!is_failed_node[node]) buffer_occupancy_table.row({node, snapshot.buffer_occupancy[node]});
+   }
+}
@@ -0,0 +1,51 @@
+#ifndef __SNAPSHOT_WRITER_H
+#define __SNAPSHOT_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Per-node counters at the start of a window, gathered by the workers (see TickPlan::snapshot).
+typedef struct {
+   int tick;                          //receive tick, which names the files
+   std::vector<int> buffer_occupancy; //[node]
+   std::vector<int> buckets_in_use;   //[node], empty unless hop-by-hop is used
+} Snapshot;
+
+//Writes snapshots to buffer-occupancy-<tick>.csv and active-buckets-<tick>.csv on a background thread, so that the
+//simulation goes on while they are written. Snapshots are written in the order in which they are submitted, and
+//their buffers are reused for later snapshots.
+class SnapshotWriter {
+   std::filesystem::path output_dir;
+   std::mutex mutex;
+   std::condition_variable submitted;
+   std::deque<std::unique_ptr<Snapshot>> queue;
+   std::vector<std::unique_ptr<Snapshot>> spare;
+   bool stopping = false;
+   std::thread writer;
+
+   public:
+   ~SnapshotWriter () { close(); }
+
+   void open (const std::filesystem::path &output_dir);
+
+   bool is_open () const { return writer.joinable(); }
+
+   //An empty snapshot for num_nodes nodes, to be filled in and submitted.
+   std::unique_ptr<Snapshot> acquire (int tick, int num_nodes, bool with_buckets);
+
+   void submit (std::unique_ptr<Snapshot> snapshot);
+
+   //Writes whatever has been submitted and stops the background thread, if it is running.
+   void close ();
+
+   private:
+   void write_snapshots ();
+   void write (const Snapshot &snapshot);
+};
+
+#endif
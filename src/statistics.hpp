@@ -0,0 +1,198 @@
+#ifndef __STATISTICS_H
+#define __STATISTICS_H
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstdint>
+#include <vector>
+#include "nodeid.hpp"
+
+//Run-wide counters. To add one, add it here and call statistics.add where it changes.
+typedef enum {
+   STAT_COMPLETED_FLOWS,
+   STAT_FRAMES_RECEIVED,
+   NUM_STATS
+} Stat;
+
+//Run-wide levels that go up and down, of which the peak is wanted. To add one, add it here and call statistics.change
+//where it changes.
+typedef enum {
+   GAUGE_BUFFERED_FRAMES,
+   GAUGE_LIVE_TRACES,
+   NUM_GAUGES
+} Gauge;
+
+//Active flow count of a destination from first_tick on, and the number of flows that name it as their credit_entry.
+typedef struct {
+   int first_tick;
+   int count;
+   int pins;
+} ActiveFlowsSince;
+
+//The active flow counts of a destination as of the start of each window. Entry i of entries is numbered first_entry + i,
+//so that flows can keep naming their entries while the older ones are dropped. With FSR, each sending flow pins the
+//entry from which its credit is next needed (Flow::credit_entry), and the entries before the first pinned one are
+//dropped at the next merge, so each history only goes back as far as its least recently caught up flow.
+typedef struct {
+   int first_entry;
+   std::vector<ActiveFlowsSince> entries;
+
+   int last_entry () const { return first_entry + (int)entries.size() - 1; }
+} ActiveFlowHistory;
+
+//Run-wide statistics that the workers update all the time. Each worker updates its own copy, padded to its own cache
+//lines, and the copies are merged into the totals while the workers are parked between windows (see TickEngine).
+//The totals, and the active flow counts, are therefore as of the start of the current window.
+//Changes to the gauges are kept by tick of the window, and merged tick by tick, so that their peaks are exact as of the
+//ends of ticks and do not depend on the number of workers.
+class Statistics {
+   typedef struct {
+      int dest;
+      int delta;
+   } FlowCountChange;
+
+   typedef struct {
+      int dest;
+      int entry;
+      int delta;
+   } PinChange;
+
+   struct alignas(64) WorkerStats {
+      int64_t counters[NUM_STATS] = {};
+      std::vector<FlowCountChange> flow_count_changes;
+      std::vector<PinChange> pin_changes;
+      std::vector<std::array<int64_t, NUM_GAUGES>> gauge_changes = {{}}; //by tick of the window
+      int tick_index = 0;
+   };
+
+   std::vector<WorkerStats> workers;
+   int64_t totals[NUM_STATS] = {};
+   int64_t gauge_levels[NUM_GAUGES] = {};
+   int64_t gauge_peaks[NUM_GAUGES] = {};
+   std::vector<int> active_flows; //by destination
+   std::vector<ActiveFlowHistory> active_flow_history; //by destination
+   std::vector<char> changed; //by destination
+   std::vector<int> changed_dests;
+
+   static inline thread_local WorkerStats *local = NULL;
+
+   public:
+   void set_num_nodes (int num_nodes) {
+      active_flows.assign(num_nodes, 0);
+      active_flow_history.assign(num_nodes, {0, {{INT_MIN, 0, 0}}});
+      changed.assign(num_nodes, false);
+   }
+
+   void set_num_workers (int num_workers) {
+      workers.resize(num_workers);
+   }
+
+   //Must be called by each worker thread before it updates anything.
+   void attach_worker (int worker) {
+      local = &workers[worker];
+   }
+
+   static void add (Stat stat, int64_t delta = 1) {
+      local->counters[stat] += delta;
+   }
+
+   //Must be called by each worker before it runs each tick of a window, with the tick's index in the window.
+   static void start_tick (int tick_index) {
+      local->tick_index = tick_index;
+      if ((int)local->gauge_changes.size() <= tick_index) local->gauge_changes.resize(tick_index + 1);
+   }
+
+   static void change (Gauge gauge, int64_t delta) {
+      local->gauge_changes[local->tick_index][gauge] += delta;
+   }
+
+   //Flows with the given destination that have started (+1) or finished sending (-1).
+   static void change_active_flows (NodeID dest, int delta) {
+      local->flow_count_changes.push_back({dest.id, delta});
+   }
+
+   //A flow with the given destination that has started (+1) or stopped (-1) naming entry as its credit_entry.
+   static void pin_entry (NodeID dest, int entry, int delta) {
+      local->pin_changes.push_back({dest.id, entry, delta});
+   }
+
+   int64_t total (Stat stat) const {
+      return totals[stat];
+   }
+
+   int64_t level (Gauge gauge) const {
+      return gauge_levels[gauge];
+   }
+
+   int64_t peak (Gauge gauge) const {
+      return gauge_peaks[gauge];
+   }
+
+   //The active flow count of dest as of the start of each window, from the earliest entry that a flow may need.
+   const ActiveFlowHistory &active_flows_with_dest (NodeID dest) const {
+      return active_flow_history[dest.id];
+   }
+
+   //Must only be called while no worker is running. window_tick is the first send tick of the next window.
+   void merge (int window_tick) {
+      for (WorkerStats &worker : workers) {
+         for (int stat = 0; stat < NUM_STATS; stat++) {
+            totals[stat] += worker.counters[stat];
+            worker.counters[stat] = 0;
+         }
+         for (const FlowCountChange &change : worker.flow_count_changes) {
+            if (!changed[change.dest]) {
+               changed[change.dest] = true;
+               changed_dests.push_back(change.dest);
+            }
+            active_flows[change.dest] += change.delta;
+         }
+         worker.flow_count_changes.clear();
+         for (const PinChange &change : worker.pin_changes) {
+            if (!changed[change.dest]) {
+               changed[change.dest] = true;
+               changed_dests.push_back(change.dest);
+            }
+            ActiveFlowHistory &history = active_flow_history[change.dest];
+            history.entries[change.entry - history.first_entry].pins += change.delta;
+         }
+         worker.pin_changes.clear();
+      }
+
+      size_t num_ticks = 0;
+      for (WorkerStats &worker : workers) {
+         num_ticks = std::max(num_ticks, worker.gauge_changes.size());
+      }
+      for (size_t tick = 0; tick < num_ticks; tick++) {
+         for (WorkerStats &worker : workers) {
+            if (tick >= worker.gauge_changes.size()) continue;
+            for (int gauge = 0; gauge < NUM_GAUGES; gauge++) {
+               gauge_levels[gauge] += worker.gauge_changes[tick][gauge];
+               worker.gauge_changes[tick][gauge] = 0;
+            }
+         }
+         for (int gauge = 0; gauge < NUM_GAUGES; gauge++) {
+            gauge_peaks[gauge] = std::max(gauge_peaks[gauge], gauge_levels[gauge]);
+         }
+      }
+
+      for (int dest : changed_dests) {
+         changed[dest] = false;
+         ActiveFlowHistory &history = active_flow_history[dest];
+         if (history.entries.back().count != active_flows[dest]) {
+            history.entries.push_back({window_tick, active_flows[dest], 0});
+         }
+         //no flow needs the entries before the first pinned one; the last entry is always kept
+         size_t unpinned = 0;
+         while (unpinned + 1 < history.entries.size() && history.entries[unpinned].pins == 0) unpinned++;
+         history.entries.erase(history.entries.begin(), history.entries.begin() + unpinned);
+         history.first_entry += unpinned;
+      }
+      changed_dests.clear();
+   }
+};
+
+extern Statistics statistics;
+
+#endif
@@ -0,0 +1,179 @@
+#include "synthetic_workload.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+const double DATAMINING_PACKET_BYTES = 1460;
+
+//A uniform double in [0, 1) from two 32-bit draws.
+double uniform (uint32_t high, uint32_t low) {
+   return (((uint64_t)high << 32 | low) >> 11) * 0x1p-53;
+}
+
+}
+
+FlowSizeCdf FlowSizeCdf::datamining () {
+   FlowSizeCdf cdf;
+   const double packets[] = {1, 2, 3, 7, 267, 2107, 66667, 666667};
+   const double probabilities[] = {0.5, 0.6, 0.7, 0.8, 0.9, 0.95, 0.99, 1};
+   for (int i = 0; i < 8; i++) {
+      cdf.sizes.push_back(packets[i] * DATAMINING_PACKET_BYTES);
+      cdf.probabilities.push_back(probabilities[i]);
+   }
+   return cdf;
+}
+
+FlowSizeCdf FlowSizeCdf::from_file (const std::string &filename) {
+   std::ifstream file(filename);
+   if (!file.is_open()) {
+      std::cerr << "Error: could not open file " << filename << std::endl;
+      exit(EXIT_FAILURE);
+   }
+   FlowSizeCdf cdf;
+   std::string line;
+   int line_number = 0;
+   while (std::getline(file, line)) {
+      line_number++;
+      size_t first = line.find_first_not_of(" \t\r");
+      if (first == std::string::npos || line[first] == '#') continue;
+      std::istringstream columns(line);
+      std::vector<double> values;
+      double value;
+      while (columns >> value) values.push_back(value);
+      if (!columns.eof() || values.size() < 2) {
+         std::cerr << "Error: malformed line " << line_number << " in " << filename << std::endl;
+         exit(EXIT_FAILURE);
+      }
+      cdf.sizes.push_back(values.front());
+      cdf.probabilities.push_back(values.back());
+   }
+   cdf.check(filename);
+   return cdf;
+}
+
+void FlowSizeCdf::check (const std::string &name) const {
+   bool valid = !sizes.empty() && std::fabs(probabilities.back() - 1) < 1e-9 && sizes[0] >= 0 && probabilities[0] >= 0;
+   for (size_t i = 1; valid && i < sizes.size(); i++) {
+      valid = sizes[i] >= sizes[i-1] && probabilities[i] >= probabilities[i-1];
+   }
+   if (!valid) {
+      std::cerr << "Error: " << name << " is not a CDF: sizes and probabilities must not decrease, and the last "
+                << "probability must be 1" << std::endl;
+      exit(EXIT_FAILURE);
+   }
+}
+
+double FlowSizeCdf::mean () const {
+   //All sizes up to the first point are that point's size, and sizes are uniform between points.
+   double sum = probabilities[0] * sizes[0];
+   for (size_t i = 1; i < sizes.size(); i++) {
+      sum += (probabilities[i] - probabilities[i-1]) * (sizes[i] + sizes[i-1]) / 2;
+   }
+   return sum;
+}
+
+long FlowSizeCdf::sample (double u) const {
+   size_t i = std::upper_bound(probabilities.begin(), probabilities.end() - 1, u) - probabilities.begin();
+   double size = sizes[i];
+   if (i > 0 && u >= probabilities[i-1]) {
+      double fraction = (u - probabilities[i-1]) / (probabilities[i] - probabilities[i-1]);
+      size = sizes[i-1] + fraction * (sizes[i] - sizes[i-1]);
+   }
+   return std::max(1L, std::lround(size));
+}
+
+SyntheticWorkload::SyntheticWorkload (const FlowSizeCdf &cdf, const SyntheticOptions &options)
+      : cdf(cdf), options(options), next_flow_id(0) {
+   int n = options.num_nodes;
+   int min_nodes = options.pattern == PATTERN_INCAST ? options.incast_receivers + 1 : 2;
+   if (n < min_nodes || (options.pattern == PATTERN_INCAST && options.incast_receivers < 1)) {
+      std::cerr << "Error: too few nodes for the traffic pattern" << std::endl;
+      exit(EXIT_FAILURE);
+   }
+   if (options.load <= 0) {
+      std::cerr << "Error: the load of a synthetic workload must be positive" << std::endl;
+      exit(EXIT_FAILURE);
+   }
+   mean_gap = cdf.mean() / (options.load * options.bytes_per_tick);
+
+   std::vector<int> shuffled(n);
+   for (int i = 0; i < n; i++) shuffled[i] = i;
+   if (options.pattern == PATTERN_PERMUTATION) {
+      //Sattolo's algorithm gives a single cycle through all nodes, so no node sends to itself.
+      for (int i = n - 1; i > 0; i--) {
+         std::swap(shuffled[i], shuffled[random_below(draws(0, i, RANDOM_WORKLOAD_PATTERN).v[0], i)]);
+      }
+      destination_of = shuffled;
+   } else if (options.pattern == PATTERN_INCAST) {
+      for (int i = 0; i < options.incast_receivers; i++) {
+         std::swap(shuffled[i], shuffled[i + random_below(draws(0, i, RANDOM_WORKLOAD_PATTERN).v[0], n - i)]);
+      }
+      receivers.assign(shuffled.begin(), shuffled.begin() + options.incast_receivers);
+   }
+
+   num_started.assign(n, 0);
+   for (int sender = 0; sender < n; sender++) {
+      if (std::find(receivers.begin(), receivers.end(), sender) != receivers.end()) continue;
+      arrivals.push_back({gap(sender, 0), sender});
+   }
+   std::make_heap(arrivals.begin(), arrivals.end(), later);
+}
+
+bool SyntheticWorkload::next (WorkloadRecord &record) {
+   if (arrivals.front().tick >= INT_MAX) return false;
+   std::pop_heap(arrivals.begin(), arrivals.end(), later);
+   Arrival &arrival = arrivals.back();
+
+   int sender = arrival.sender;
+   uint64_t index = num_started[sender]++;
+   Philox4x32::Block block = draws(sender, index, RANDOM_WORKLOAD_FLOW);
+   record.flow_id = next_flow_id;
+   next_flow_id = next_flow_id == INT_MAX ? 0 : next_flow_id + 1;
+   record.source = sender;
+   switch (options.pattern) {
+      case PATTERN_UNIFORM:
+         record.dest = random_below(block.v[3], options.num_nodes - 1);
+         if (record.dest >= sender) record.dest++;
+         break;
+      case PATTERN_PERMUTATION:
+         record.dest = destination_of[sender];
+         break;
+      case PATTERN_INCAST:
+         record.dest = receivers[random_below(block.v[3], (int)receivers.size())];
+         break;
+   }
+   record.size = cdf.sample(uniform(block.v[2], 0));
+   record.start_time = arrival.tick * options.slot_length;
+
+   arrival.tick += gap(sender, index + 1);
+   std::push_heap(arrivals.begin(), arrivals.end(), later);
+   return true;
+}
+
+bool SyntheticWorkload::later (const Arrival &a, const Arrival &b) {
+   return a.tick > b.tick || (a.tick == b.tick && a.sender > b.sender);
+}
+
+bool SyntheticWorkload::parse_pattern (const std::string &name, TrafficPattern &pattern) {
+   if (name == "uniform") pattern = PATTERN_UNIFORM;
+   else if (name == "permutation") pattern = PATTERN_PERMUTATION;
+   else if (name == "incast") pattern = PATTERN_INCAST;
+   else return false;
+   return true;
+}
+
+Philox4x32::Block SyntheticWorkload::draws (int sender, uint64_t index, RandomPurpose purpose) const {
+   return Philox4x32::generate({{(uint32_t)index, (uint32_t)sender, (uint32_t)purpose, (uint32_t)(index >> 32)}},
+                               options.seed);
+}
+
+double SyntheticWorkload::gap (int sender, uint64_t index) const {
+   Philox4x32::Block block = draws(sender, index, RANDOM_WORKLOAD_FLOW);
+   return -mean_gap * std::log1p(-uniform(block.v[0], block.v[1]));
+}
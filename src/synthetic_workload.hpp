@@ -0,0 +1,92 @@
+#ifndef __SYNTHETIC_WORKLOAD_H
+#define __SYNTHETIC_WORKLOAD_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "workload.hpp"
+#include "philox.hpp"
+
+//Flow size distribution given by points of its CDF, between which it is interpolated linearly.
+class FlowSizeCdf {
+   std::vector<double> sizes;         //bytes, increasing
+   std::vector<double> probabilities; //increasing, ending with 1
+
+   public:
+   //The data mining workload of Alizadeh et al., "pFabric: Minimal Near-Optimal Datacenter Transport", in packets
+   //of 1460 bytes.
+   static FlowSizeCdf datamining ();
+
+   //Reads a CDF file with one point per line: the size in bytes, then the cumulative probability, as the last of any
+   //number of whitespace-separated columns (so the three-column files of ns-2's EmpiricalRandomVariable work as
+   //they are). Lines starting with # are skipped. Exits with an error message if the file is malformed.
+   static FlowSizeCdf from_file (const std::string &filename);
+
+   //Mean flow size, in bytes.
+   double mean () const;
+
+   //The size, in bytes, at quantile u in [0, 1).
+   long sample (double u) const;
+
+   private:
+   //Exits with an error message (mentioning name) unless the points describe a CDF.
+   void check (const std::string &name) const;
+};
+
+//Where the flows of a synthetic workload go.
+typedef enum {
+   PATTERN_UNIFORM,     //to any other node, uniformly at random
+   PATTERN_PERMUTATION, //each node to a fixed other node, the pairs forming a random permutation
+   PATTERN_INCAST,      //from every other node to one of a few random receivers
+} TrafficPattern;
+
+typedef struct {
+   int num_nodes;          //nodes that take part; records use IDs 0 to num_nodes-1
+   double load;            //fraction of each sender's capacity taken up by the flows it starts
+   double bytes_per_tick;  //capacity of a sender
+   double slot_length;     //seconds per tick
+   TrafficPattern pattern;
+   int incast_receivers;   //for PATTERN_INCAST
+   uint64_t seed;
+} SyntheticOptions;
+
+//Generates a workload as it is read: each sender starts flows as a Poisson process, with sizes drawn from a
+//FlowSizeCdf and destinations given by the pattern, and the senders' flows are merged by start time.
+//Each flow is a pure function of the seed, its sender and its index among the sender's flows, so the workload does not
+//depend on how far or how fast it is read, and only the senders' next flows are held in memory.
+//Runs until the start times would no longer fit in a tick counter.
+class SyntheticWorkload : public RecordSource {
+   typedef struct {
+      double tick;    //start of the sender's next flow
+      int sender;
+   } Arrival;
+
+   FlowSizeCdf cdf;
+   SyntheticOptions options;
+   double mean_gap;                  //ticks between a sender's flows, on average
+   std::vector<int> destination_of;  //for PATTERN_PERMUTATION
+   std::vector<int> receivers;       //for PATTERN_INCAST
+   std::vector<uint64_t> num_started; //[sender], flows started so far
+   std::vector<Arrival> arrivals;    //min-heap on (tick, sender), one per sender
+   int next_flow_id;
+
+   public:
+   SyntheticWorkload (const FlowSizeCdf &cdf, const SyntheticOptions &options);
+
+   bool next (WorkloadRecord &record) override;
+
+   //Parses the name of a pattern (uniform, permutation or incast). Returns false if there is no such pattern.
+   static bool parse_pattern (const std::string &name, TrafficPattern &pattern);
+
+   private:
+   //Orders the heap of arrivals by (tick, sender), earliest first.
+   static bool later (const Arrival &a, const Arrival &b);
+
+   //Four independent 32-bit draws, for the index-th flow of sender or the index-th step of setting up the pattern.
+   Philox4x32::Block draws (int sender, uint64_t index, RandomPurpose purpose) const;
+
+   //Ticks from a sender's previous flow (or from tick 0) to its index-th flow.
+   double gap (int sender, uint64_t index) const;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "tick_engine.hpp"
+#include "statistics.hpp"
+#include <algorithm>
+#include <climits>
+#include <pthread.h>
+#include <sched.h>
+
+TickBarrier::TickBarrier (int count) : count(count), remaining(count), generation(0) {}
+
+TickEngine::TickEngine (std::vector<Node *> &nodes, int num_workers) : nodes(nodes),
+                                                                          kernel(Node::kernel()),
+                                                                          num_workers(std::clamp(num_workers, 1, (int)nodes.size())),
+                                                                          barrier(this->num_workers)
+{
+   //Contiguous partitions, so that each worker streams through the same nodes every stage of every tick.
+   for (int w = 0; w <= this->num_workers; w++) {
+      partition_start.push_back((int)((long)nodes.size() * w / this->num_workers));
+   }
+   for (auto node : nodes) {
+      node->update_wake_tick();
+   }
+   running = false;
+   plan = {};
+   summaries.resize(this->num_workers);
+   statistics.set_num_workers(this->num_workers);
+
+   //The first frame over the link of epoch slot i is received at tick r < EPOCH_LENGTH. From PROP_DELAY_TS ticks
+   //later, the sending side starts to return tokens in every tick of slot i.
+   first_token_tick.resize(EPOCH_LENGTH);
+   for (int receive_tick = 0; receive_tick < EPOCH_LENGTH; receive_tick++) {
+      int cur_phase = (receive_tick / LINKS_PER_PHASE) % NUM_PHASES;
+      int cur_link = receive_tick % LINKS_PER_PHASE;
+      int recv_index = LINKS_PER_PHASE - 1 - cur_link + cur_phase * LINKS_PER_PHASE;
+      int first_received_tick = receive_tick + PROP_DELAY_TS;
+      int offset = ((recv_index - first_received_tick - 1) % EPOCH_LENGTH + EPOCH_LENGTH) % EPOCH_LENGTH;
+      first_token_tick[recv_index] = first_received_tick + 1 + offset;
+   }
+}
+
+void TickEngine::run (std::function<bool (TickPlan &)> plan_window) {
+   std::vector<std::thread> threads;
+   for (int w = 0; w < num_workers; w++) {
+      threads.emplace_back(&TickEngine::worker_loop, this, w, std::ref(plan_window));
+      pin_to_cpu(threads.back(), w);
+   }
+   for (auto &thread : threads) {
+      thread.join();
+   }
+}
+
+void TickEngine::worker_loop (int worker, std::function<bool (TickPlan &)> &plan_window) {
+   const int begin = partition_start[worker];
+   const int end = partition_start[worker + 1];
+   auto serial_section = [&]{
+      statistics.merge(plan.end_send_tick);
+      running = plan_window(plan);
+   };
+   statistics.attach_worker(worker);
+
+   for (;;) {
+      barrier.arrive_and_wait(serial_section);
+      if (!running) return;
+
+      if (plan.snapshot) {
+         for (int i = begin; i < end; i++) {
+            nodes[i]->gather_snapshot(*plan.snapshot);
+         }
+      }
+
+      bool sent = false;
+      for (int send_tick = plan.first_send_tick; send_tick < plan.end_send_tick; send_tick++) {
+         Statistics::start_tick(send_tick - plan.first_send_tick);
+         sent |= run_tick(begin, end, send_tick);
+      }
+
+      //Other workers may still be sending to our nodes, so their inbound counts are not final yet.
+      //Whatever they send is covered by their own summaries, though, as is whatever we sent ourselves.
+      int next_busy_tick = sent ? plan.end_send_tick : INT_MAX;
+      for (int i = begin; i < end && next_busy_tick > plan.end_send_tick; i++) {
+         if (node_activity[i].inbound > 0) {
+            next_busy_tick = plan.end_send_tick;
+         } else {
+            next_busy_tick = std::min(next_busy_tick, std::max(node_activity[i].wake_tick, plan.end_send_tick));
+         }
+      }
+      summaries[worker].next_busy_tick = next_busy_tick;
+   }
+}
+
+//Runs every stage of one tick for the nodes in [begin, end). Returns whether any of them was awake.
+bool TickEngine::run_tick (int begin, int end, int send_tick) {
+   const int receive_tick = send_tick - PROP_DELAY_TS;
+   const bool send_tokens = USE_HBH && tokens_exchanged(send_tick);
+
+   bool sent = kernel.send(nodes.data(), begin, end, send_tick, send_tokens);
+   //Without propagation delay, this tick's sends are received right away.
+   if (PROP_DELAY_TS == 0) barrier.arrive_and_wait();
+
+   if (receive_tick < 0) return sent;
+   const bool receive_tokens = USE_HBH && tokens_exchanged(receive_tick);
+   kernel.receive(nodes.data(), begin, end, receive_tick, receive_tokens);
+   return sent;
+}
+
+int TickEngine::next_busy_tick () {
+   int next_busy_tick = INT_MAX;
+   for (auto &summary : summaries) {
+      next_busy_tick = std::min(next_busy_tick, summary.next_busy_tick);
+   }
+   return next_busy_tick;
+}
+
+//Pins worker w to the w-th CPU that this process is allowed to run on (e.g. the CPUs of a Slurm allocation).
+void TickEngine::pin_to_cpu (std::thread &thread, int worker) {
+   cpu_set_t allowed;
+   CPU_ZERO(&allowed);
+   if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+   int num_allowed = CPU_COUNT(&allowed);
+   if (num_allowed == 0) return;
+
+   int target = worker % num_allowed;
+   for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (!CPU_ISSET(cpu, &allowed)) continue;
+      if (target-- == 0) {
+         cpu_set_t pinned;
+         CPU_ZERO(&pinned);
+         CPU_SET(cpu, &pinned);
+         pthread_setaffinity_np(thread.native_handle(), sizeof(pinned), &pinned);
+         return;
+      }
+   }
+}
@@ -0,0 +1,101 @@
+#ifndef __TICK_ENGINE_H
+#define __TICK_ENGINE_H
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "defines.hpp"
+#include "node.hpp"
+
+//The ticks that the workers run before they next synchronize. Filled in by the serial per-window callback.
+//A window never spans more than PROP_DELAY_TS ticks (one tick if there is no propagation delay), so nothing that is
+//sent during a window can be received before the window is over.
+typedef struct {
+   int first_send_tick;
+   int end_send_tick; //one past the last send tick of the window
+   Snapshot *snapshot; //if set, each worker fills in its nodes' entries before the window's first tick
+} TickPlan;
+
+//Per-worker results, padded so that workers do not share cache lines.
+struct alignas(64) WorkerSummary {
+   int next_busy_tick;
+};
+
+//Sense-reversing barrier. The last thread to arrive runs the serial section before releasing the others.
+//Waiters spin briefly and then sleep on the generation counter, so oversubscribed runs do not burn their timeslice.
+class TickBarrier {
+   int count;
+   std::atomic_int remaining;
+   std::atomic_uint generation;
+
+   public:
+   TickBarrier (int count);
+
+   template <typename F>
+   void arrive_and_wait (F &&serial_section) {
+      unsigned int gen = generation.load(std::memory_order_acquire);
+      if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+         serial_section();
+         remaining.store(count, std::memory_order_relaxed);
+         generation.fetch_add(1, std::memory_order_release);
+         generation.notify_all();
+         return;
+      }
+      for (int spin = 0; spin < SPIN_LIMIT; spin++) {
+         if (generation.load(std::memory_order_acquire) != gen) return;
+      }
+      while (generation.load(std::memory_order_acquire) == gen) {
+         generation.wait(gen, std::memory_order_acquire);
+      }
+   }
+
+   void arrive_and_wait () {
+      arrive_and_wait([]{});
+   }
+
+   private:
+   static constexpr int SPIN_LIMIT = 4096;
+};
+
+//Runs the main loop on a persistent pool of pinned worker threads.
+//Each worker owns a fixed, contiguous partition of the nodes for the whole run, and executes every stage of every
+//tick for that partition. Stages that only touch a node's own state are fused per node.
+//Whatever a node sends at tick t is only received at t + PROP_DELAY_TS, so the workers only synchronize at the ends
+//of windows of up to PROP_DELAY_TS ticks. Without propagation delay, every tick also needs a barrier between its
+//send and receive halves.
+class TickEngine {
+   std::vector<Node *> &nodes;
+   const NodeKernel &kernel;
+   int num_workers;
+   std::vector<int> partition_start;
+   TickBarrier barrier;
+   TickPlan plan;
+   bool running;
+   std::vector<WorkerSummary> summaries;
+   //With hop-by-hop, tokens are only exchanged in the slots of the epoch in which a first frame (and then its feedback)
+   //has made it across the link. first_token_tick[i] is the first tick of slot i in which tokens are sent;
+   //from then on they are sent, and received PROP_DELAY_TS ticks later, in every tick of that slot.
+   std::vector<int> first_token_tick;
+
+   public:
+   TickEngine (std::vector<Node *> &nodes, int num_workers);
+
+   int workers () const { return num_workers; }
+
+   //Runs windows of ticks until plan_window returns false.
+   //plan_window is called at the start of every window while every worker is parked at the barrier, so it may freely
+   //read node state. It is passed the previous window's plan (all zeros the first time).
+   void run (std::function<bool (TickPlan &)> plan_window);
+
+   //Earliest tick at which some node has work to do, as of the end of the previous window.
+   int next_busy_tick ();
+
+   private:
+   void worker_loop (int worker, std::function<bool (TickPlan &)> &plan_window);
+   bool run_tick (int begin, int end, int send_tick);
+   bool tokens_exchanged (int tick) const { return tick >= first_token_tick[tick % EPOCH_LENGTH]; }
+   static void pin_to_cpu (std::thread &thread, int worker);
+};
+
+#endif
@@ -60,14 +60,14 @@ namespace better_priority_queue {
              *  Returns true if the priority was changed.
              * */
             bool set(const Key& key, const Priority& priority, bool only_if_higher=false) {
-               if(key < id_to_heappos.size() && id_to_heappos[key] < ((size_t)-2)) // This key is already in the pQ
+               if((size_t)key < id_to_heappos.size() && id_to_heappos[key] < ((size_t)-2)) // This key is already in the pQ
                   return update(key, priority, only_if_higher);
                else
                   return push(key, priority, only_if_higher);
             }
 
             std::pair<bool,Priority> get_priority(const Key& key) {
-               if(key < id_to_heappos.size()) {
+               if((size_t)key < id_to_heappos.size()) {
                   size_t pos = id_to_heappos[key];
                   if(pos < ((size_t)-2)) {
                      return {true, heap[pos].priority};
@@ -93,7 +93,7 @@ namespace better_priority_queue {
 
             /** Returns true if the key was already inside and was updated, otherwise does nothing and returns false */
             bool update(const Key& key, const Priority& new_priority, bool only_if_higher=false) {
-               if(key >= id_to_heappos.size()) return false;
+               if((size_t)key >= id_to_heappos.size()) return false;
                size_t heappos = id_to_heappos[key];
                if(heappos >= ((size_t)-2)) return false;
                Priority& priority = heap[heappos].priority;
@@ -0,0 +1,656 @@
+#include "workload.hpp"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t CHUNK_SIZE = 8 << 20;    //bytes of CSV
+const size_t BINARY_CHUNK = 1 << 20;  //flows of a binary workload
+
+const char BINARY_MAGIC[8] = {'W', 'L', 'B', 'I', 'N', 'v', '0', '1'};
+const char CACHE_MAGIC[8] = {'W', 'L', 'C', 'A', 'C', 'H', 'v', '3'};
+const int MAX_WORKLOAD_CACHES = 4;    //per workload file, the least recently used ones are deleted
+
+//A binary workload is this header, followed by the flow_id, source and dest columns (int32), the size column (int64)
+//and the start_time column (double), each padded to a multiple of 8 bytes.
+typedef struct {
+   char magic[8];
+   uint64_t num_flows;
+} BinaryHeader;
+
+//A workload cache is this header, followed by the flows.
+typedef struct {
+   char magic[8];
+   uint64_t key;          //of the options the flows were read with
+   uint64_t content_hash; //of the CSV file the flows were read from
+   uint64_t file_size;    //of the CSV file
+   int64_t mtime_ns;      //of the CSV file, when the cache was written
+   uint64_t num_flows;
+   uint64_t flow_size; //sizeof(Flow) when the cache was written
+} CacheHeader;
+
+//The flows read from one chunk of a workload.
+typedef struct {
+   std::vector<Flow> flows;
+   bool stopped; //a flow starting before tick 0 was found, and the flows after it were left out
+} ChunkResult;
+
+typedef enum {FLOW_KEPT, FLOW_SKIPPED, FLOW_STOPS_READING} RecordOutcome;
+
+//Reports an error on errors and exits. Chunks are parsed in parallel, so only the first error is reported.
+[[noreturn]] void exit_with_error (std::ostream &errors, const std::string &message) {
+   static std::mutex mutex;
+   mutex.lock();
+   errors << "Error: " << message << std::endl;
+   exit(EXIT_FAILURE);
+}
+
+//A file mapped read-only into memory.
+class MappedFile {
+   public:
+   const char *data = NULL;
+   size_t size = 0;
+   int64_t mtime_ns = 0; //last modification
+
+   //Returns false if the file cannot be opened or mapped.
+   bool open (const std::string &filename) {
+      int fd = ::open(filename.c_str(), O_RDONLY);
+      struct stat file_stat;
+      if (fd < 0) return false;
+      if (fstat(fd, &file_stat) != 0) {
+         ::close(fd);
+         return false;
+      }
+      size = file_stat.st_size;
+      mtime_ns = file_stat.st_mtim.tv_sec * (int64_t)1000000000 + file_stat.st_mtim.tv_nsec;
+      if (size > 0) {
+         void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+         if (mapping == MAP_FAILED) {
+            ::close(fd);
+            size = 0;
+            return false;
+         }
+         madvise(mapping, size, MADV_SEQUENTIAL);
+         data = (const char *)mapping;
+      }
+      ::close(fd);
+      return true;
+   }
+
+   ~MappedFile () {
+      if (data) munmap((void *)data, size);
+   }
+};
+
+void open_or_exit (MappedFile &file, const std::string &filename, std::ostream &errors) {
+   if (!file.open(filename)) exit_with_error(errors, "could not open file " + filename);
+}
+
+//Runs task(chunk) for every chunk in [first, last) on up to num_threads threads.
+template <typename F>
+void parallel_for_chunks (int first, int last, int num_threads, F &&task) {
+   std::atomic_int next_chunk = first;
+   auto run_chunks = [&]{
+      for (int chunk = next_chunk++; chunk < last; chunk = next_chunk++) {
+         task(chunk);
+      }
+   };
+   std::vector<std::thread> threads;
+   for (int t = 1; t < std::min(num_threads, last - first); t++) {
+      threads.emplace_back(run_chunks);
+   }
+   run_chunks();
+   for (auto &thread : threads) {
+      thread.join();
+   }
+}
+
+[[noreturn]] void malformed_line (const char *begin, const char *end, std::ostream &errors) {
+   exit_with_error(errors, "malformed workload line: " + std::string(begin, end));
+}
+
+//Skips the separator before the next field, if any: blanks and at most one comma (like the old stream parser).
+const char *skip_separator (const char *pos, const char *end) {
+   while (pos < end && (*pos == ' ' || *pos == '\t')) pos++;
+   if (pos < end && *pos == ',') pos++;
+   while (pos < end && (*pos == ' ' || *pos == '\t')) pos++;
+   return pos;
+}
+
+template <typename T>
+const char *parse_field (const char *pos, const char *end, T &value, const char *line, std::ostream &errors) {
+   auto [next, error] = std::from_chars(pos, end, value);
+   if (error != std::errc()) malformed_line(line, end, errors);
+   return skip_separator(next, end);
+}
+
+//Parses the next non-blank line at or after pos, which is at a line boundary before end, and moves pos past it.
+//Returns false if there is none.
+bool next_record (const char *&pos, const char *end, WorkloadRecord &record, std::ostream &errors) {
+   while (pos < end) {
+      const char *line = pos;
+      const char *line_end = std::find(line, end, '\n');
+      pos = line_end < end ? line_end + 1 : end;
+      while (line_end > line && (line_end[-1] == '\r' || line_end[-1] == ' ' || line_end[-1] == '\t')) line_end--;
+      const char *field = skip_separator(line, line_end);
+      if (field == line_end) continue;
+
+      field = parse_field(field, line_end, record.flow_id, line, errors);
+      field = parse_field(field, line_end, record.source, line, errors);
+      field = parse_field(field, line_end, record.dest, line, errors);
+      field = parse_field(field, line_end, record.size, line, errors);
+      parse_field(field, line_end, record.start_time, line, errors);
+      return true;
+   }
+   return false;
+}
+
+//Calls record_found for each line in [begin, end), which starts at a line boundary, until it returns false.
+template <typename F>
+void parse_lines (const char *begin, const char *end, std::ostream &errors, F &&record_found) {
+   WorkloadRecord record;
+   for (const char *pos = begin; next_record(pos, end, record, errors); ) {
+      if (!record_found(record)) return;
+   }
+}
+
+//Splits [0, size) into chunks of about CHUNK_SIZE bytes that end at line boundaries.
+std::vector<size_t> chunk_boundaries (const char *data, size_t size) {
+   std::vector<size_t> boundaries{0};
+   while (boundaries.back() < size) {
+      size_t boundary = std::min(boundaries.back() + CHUNK_SIZE, size);
+      const char *newline = std::find(data + boundary, data + size, '\n');
+      boundaries.push_back(newline < data + size ? newline - data + 1 : size);
+   }
+   return boundaries;
+}
+
+int node_of (int read_id, const WorkloadOptions &options) {
+   if (read_id < 0 || read_id >= (int)options.node_of_id->size()) {
+      exit_with_error(*options.errors, "node ID " + std::to_string(read_id) + " in the workload is out of range");
+   }
+   return (*options.node_of_id)[read_id];
+}
+
+//Reading a workload stops at the first such record, whatever the options. convert_workload leaves it and the records
+//after it out as well.
+bool stops_reading (const WorkloadRecord &record) {
+   return record.start_time < 0;
+}
+
+RecordOutcome make_flow (const WorkloadRecord &record, const WorkloadOptions &options, Flow &flow) {
+   if (stops_reading(record)) return FLOW_STOPS_READING;
+   if (record.size < options.min_flow_size) return FLOW_SKIPPED;
+   if (record.size > options.max_flow_size) return FLOW_SKIPPED;
+   const auto &levels = *options.quantization_levels;
+   flow = {};
+   flow.flow_id = record.flow_id;
+   flow.source_id.id = node_of(record.source, options);
+   flow.dest_id.id = node_of(record.dest, options);
+   long flow_length = (long)(record.size * options.flow_size_multiplier);
+   flow.num_frames = (flow_length + options.payload_length - 1) / options.payload_length;
+   flow.remain_frames = flow.num_frames;
+   flow.quantized_num_frames = *std::prev(std::upper_bound(levels.begin(), levels.end(), flow.num_frames));
+   flow.start_tick = (record.start_time / options.load_factor) / options.slot_length;
+   return FLOW_KEPT;
+}
+
+//Adds record to result, unless it is skipped. Returns false once the chunk is done: no chunk can contribute more than
+//max_flows flows, or any flows after one that stops reading.
+bool add_record (const WorkloadRecord &record, const WorkloadOptions &options, ChunkResult &result) {
+   Flow flow;
+   switch (make_flow(record, options, flow)) {
+      case FLOW_KEPT:
+         result.flows.push_back(flow);
+         return (int)result.flows.size() < options.max_flows;
+      case FLOW_SKIPPED:
+         return true;
+      default:
+         result.stopped = true;
+         return false;
+   }
+}
+
+//Reads num_chunks chunks with read_chunk(chunk, result) and puts their flows together in order.
+//With a flow limit, the chunks are read in batches of one per thread, so that not much more than needed is read.
+template <typename F>
+std::vector<Flow> collect_flows (int num_chunks, const WorkloadOptions &options, int num_threads, F &&read_chunk) {
+   int batch_size = options.max_flows == INT_MAX ? num_chunks : num_threads;
+   std::vector<Flow> flows;
+   bool stopped = false;
+   for (int first_chunk = 0; first_chunk < num_chunks && !stopped; first_chunk += batch_size) {
+      int last_chunk = std::min(first_chunk + batch_size, num_chunks);
+      std::vector<ChunkResult> results(last_chunk - first_chunk);
+      parallel_for_chunks(first_chunk, last_chunk, num_threads, [&](int chunk) {
+         results[chunk - first_chunk].stopped = false;
+         read_chunk(chunk, results[chunk - first_chunk]);
+      });
+
+      //each chunk's flows are freed as soon as they have been merged
+      for (ChunkResult &result : results) {
+         size_t wanted = std::min(result.flows.size(), (size_t)options.max_flows - flows.size());
+         if (flows.empty()) {
+            result.flows.resize(wanted);
+            flows = std::move(result.flows);
+         } else {
+            flows.insert(flows.end(), result.flows.begin(), result.flows.begin() + wanted);
+         }
+         std::vector<Flow>().swap(result.flows);
+         if (result.stopped || flows.size() == (size_t)options.max_flows) {
+            stopped = true;
+            break;
+         }
+      }
+   }
+
+   std::stable_sort(flows.begin(), flows.end(), [](const Flow &a, const Flow &b) {
+      return a.start_tick < b.start_tick;
+   });
+   return flows;
+}
+
+std::vector<Flow> read_csv (const MappedFile &file, const std::vector<size_t> &boundaries,
+                            const WorkloadOptions &options, int num_threads) {
+   return collect_flows(boundaries.size() - 1, options, num_threads, [&](int chunk, ChunkResult &result) {
+      parse_lines(file.data + boundaries[chunk], file.data + boundaries[chunk+1], *options.errors,
+                  [&](const WorkloadRecord &record) {
+         return add_record(record, options, result);
+      });
+   });
+}
+
+//Offsets of the columns of a binary workload of num_flows flows, and the file size.
+typedef struct {
+   size_t flow_id, source, dest, size, start_time, end;
+} BinaryLayout;
+
+size_t padded (size_t bytes) {
+   return (bytes + 7) / 8 * 8;
+}
+
+BinaryLayout binary_layout (uint64_t num_flows) {
+   BinaryLayout layout;
+   layout.flow_id = sizeof(BinaryHeader);
+   layout.source = layout.flow_id + padded(num_flows * sizeof(int32_t));
+   layout.dest = layout.source + padded(num_flows * sizeof(int32_t));
+   layout.size = layout.dest + padded(num_flows * sizeof(int32_t));
+   layout.start_time = layout.size + num_flows * sizeof(int64_t);
+   layout.end = layout.start_time + num_flows * sizeof(double);
+   return layout;
+}
+
+bool is_binary_workload (const MappedFile &file) {
+   return file.size >= sizeof(BinaryHeader) && memcmp(file.data, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+}
+
+//The columns of a mapped binary workload.
+struct BinaryColumns {
+   uint64_t num_flows;
+   const int32_t *flow_ids;
+   const int32_t *sources;
+   const int32_t *dests;
+   const int64_t *sizes;
+   const double *start_times;
+
+   WorkloadRecord record (size_t i) const {
+      return {flow_ids[i], sources[i], dests[i], (long)sizes[i], start_times[i]};
+   }
+};
+
+BinaryColumns binary_columns (const MappedFile &file, const std::string &filename, std::ostream &errors) {
+   BinaryHeader header;
+   memcpy(&header, file.data, sizeof(header));
+   BinaryLayout layout = binary_layout(header.num_flows);
+   if (layout.end != file.size) exit_with_error(errors, "binary workload " + filename + " is truncated or corrupt");
+   return {header.num_flows, (const int32_t *)(file.data + layout.flow_id), (const int32_t *)(file.data + layout.source),
+           (const int32_t *)(file.data + layout.dest), (const int64_t *)(file.data + layout.size),
+           (const double *)(file.data + layout.start_time)};
+}
+
+std::vector<Flow> read_binary (const MappedFile &file, const std::string &filename, const WorkloadOptions &options,
+                               int num_threads) {
+   BinaryColumns columns = binary_columns(file, filename, *options.errors);
+   int num_chunks = (columns.num_flows + BINARY_CHUNK - 1) / BINARY_CHUNK;
+   return collect_flows(num_chunks, options, num_threads, [&](int chunk, ChunkResult &result) {
+      size_t end = std::min((chunk + 1) * BINARY_CHUNK, (size_t)columns.num_flows);
+      for (size_t i = chunk * BINARY_CHUNK; i < end; i++) {
+         if (!add_record(columns.record(i), options, result)) break;
+      }
+   });
+}
+
+//Fast 64-bit hash of a block of memory (not cryptographic: it only tells workload files apart).
+uint64_t hash_bytes (const char *data, size_t size, uint64_t seed) {
+   uint64_t hash = seed ^ (size * 0x9e3779b97f4a7c15ull);
+   size_t i = 0;
+   for (; i + 8 <= size; i += 8) {
+      uint64_t word;
+      memcpy(&word, data + i, 8);
+      hash = (hash ^ word) * 0xbf58476d1ce4e5b9ull;
+      hash ^= hash >> 29;
+   }
+   for (; i < size; i++) {
+      hash = (hash ^ (unsigned char)data[i]) * 0x94d049bb133111ebull;
+   }
+   hash ^= hash >> 31;
+   hash *= 0x94d049bb133111ebull;
+   return hash ^ (hash >> 32);
+}
+
+template <typename T>
+uint64_t hash_value (const T &value, uint64_t seed) {
+   return hash_bytes((const char *)&value, sizeof(T), seed);
+}
+
+template <typename T>
+uint64_t hash_vector (const std::vector<T> &values, uint64_t seed) {
+   return hash_bytes((const char *)values.data(), values.size() * sizeof(T), seed);
+}
+
+//Hash of the file's contents, which a cache must match to be used.
+uint64_t content_hash (const MappedFile &file, const std::vector<size_t> &boundaries, int num_threads) {
+   std::vector<uint64_t> chunk_hashes(boundaries.size() - 1);
+   parallel_for_chunks(0, chunk_hashes.size(), num_threads, [&](int chunk) {
+      chunk_hashes[chunk] = hash_bytes(file.data + boundaries[chunk], boundaries[chunk+1] - boundaries[chunk], chunk);
+   });
+   return hash_vector(chunk_hashes, 0);
+}
+
+//Hash of everything in options that affects the flows read from a file.
+uint64_t cache_key (const WorkloadOptions &options) {
+   uint64_t key = hash_value(sizeof(Flow), 0);
+   key = hash_value(options.max_flows, key);
+   key = hash_value(options.min_flow_size, key);
+   key = hash_value(options.max_flow_size, key);
+   key = hash_value(options.flow_size_multiplier, key);
+   key = hash_value(options.load_factor, key);
+   key = hash_value(options.payload_length, key);
+   key = hash_value(options.slot_length, key);
+   key = hash_vector(*options.node_of_id, key);
+   return hash_vector(*options.quantization_levels, key);
+}
+
+const char CACHE_SUFFIX[] = ".cache";
+
+std::string cache_filename (const std::string &filename, uint64_t key) {
+   char suffix[32];
+   snprintf(suffix, sizeof(suffix), ".%016llx%s", (unsigned long long)key, CACHE_SUFFIX);
+   return filename + suffix;
+}
+
+//Opens the cache and reads its header. Returns false if it is missing, malformed, for other options or for a file
+//of another size.
+bool open_cache (const std::string &cache_name, uint64_t key, const MappedFile &file, MappedFile &cache,
+                 CacheHeader &header) {
+   if (!cache.open(cache_name) || cache.size < sizeof(CacheHeader)) return false;
+   memcpy(&header, cache.data, sizeof(header));
+   return memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 && header.key == key
+          && header.flow_size == sizeof(Flow) && cache.size == sizeof(header) + header.num_flows * sizeof(Flow)
+          && header.file_size == file.size;
+}
+
+//Writes to a temporary file that is then renamed, so that runs that start at the same time never see half a cache.
+bool save_cache (const std::string &cache_name, uint64_t key, uint64_t content_hash, const MappedFile &file,
+                 const std::vector<Flow> &flows) {
+   std::string temp_name = cache_name + ".tmp-" + std::to_string(getpid());
+   {
+      std::ofstream out(temp_name, std::ios::binary);
+      if (!out.is_open()) return false;
+      CacheHeader header;
+      memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+      header.key = key;
+      header.content_hash = content_hash;
+      header.file_size = file.size;
+      header.mtime_ns = file.mtime_ns;
+      header.num_flows = flows.size();
+      header.flow_size = sizeof(Flow);
+      out.write((const char *)&header, sizeof(header));
+      out.write((const char *)flows.data(), flows.size() * sizeof(Flow));
+      if (!out.good()) {
+         out.close();
+         std::filesystem::remove(temp_name);
+         return false;
+      }
+   }
+   std::error_code error;
+   std::filesystem::rename(temp_name, cache_name, error);
+   return !error;
+}
+
+//Deletes all but the MAX_WORKLOAD_CACHES most recently used caches of filename (one per set of options).
+//A cache is marked as used by setting its modification time whenever it is loaded.
+void evict_caches (const std::string &filename, std::ostream &log) {
+   std::filesystem::path path = std::filesystem::absolute(filename);
+   std::string prefix = path.filename().string() + ".";
+   std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> caches;
+   std::error_code error;
+   for (const auto &entry : std::filesystem::directory_iterator(path.parent_path(), error)) {
+      std::string name = entry.path().filename().string();
+      //the 16 hex digits of the key between the prefix and the suffix
+      if (name.size() != prefix.size() + 16 + strlen(CACHE_SUFFIX) || name.compare(0, prefix.size(), prefix) != 0
+          || !name.ends_with(CACHE_SUFFIX)) {
+         continue;
+      }
+      std::error_code time_error;
+      auto time = entry.last_write_time(time_error);
+      if (!time_error) caches.emplace_back(time, entry.path());
+   }
+   if ((int)caches.size() <= MAX_WORKLOAD_CACHES) return;
+   std::sort(caches.begin(), caches.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+   for (size_t i = MAX_WORKLOAD_CACHES; i < caches.size(); i++) {
+      if (std::filesystem::remove(caches[i].second, error)) {
+         log << "Deleted workload cache " << caches[i].second.string() << std::endl;
+      }
+   }
+}
+
+}
+
+std::vector<Flow> read_workload (const std::string &filename, const WorkloadOptions &options, int num_threads,
+                                 WorkloadCache cache, std::ostream &log) {
+   num_threads = std::max(1, num_threads);
+   MappedFile file;
+   open_or_exit(file, filename, *options.errors);
+   if (is_binary_workload(file)) {
+      log << "Reading binary workload" << std::endl;
+      return read_binary(file, filename, options, num_threads);
+   }
+
+   std::vector<size_t> boundaries = chunk_boundaries(file.data, file.size);
+   if (cache == WORKLOAD_CACHE_OFF) return read_csv(file, boundaries, options, num_threads);
+
+   uint64_t key = cache_key(options);
+   std::string cache_name = cache_filename(filename, key);
+   bool hashed = false;
+   uint64_t hash = 0;
+   {
+      MappedFile cache_file;
+      CacheHeader header;
+      bool usable = open_cache(cache_name, key, file, cache_file, header);
+      if (usable && !(cache == WORKLOAD_CACHE_TRUST_MTIME && header.mtime_ns == file.mtime_ns)) {
+         hash = content_hash(file, boundaries, num_threads);
+         hashed = true;
+         usable = header.content_hash == hash;
+      }
+      if (usable) {
+         std::vector<Flow> flows(header.num_flows);
+         memcpy(flows.data(), cache_file.data + sizeof(header), header.num_flows * sizeof(Flow));
+         std::error_code error;
+         std::filesystem::last_write_time(cache_name, std::filesystem::file_time_type::clock::now(), error);
+         log << "Loaded flows from workload cache " << cache_name << std::endl;
+         return flows;
+      }
+   }
+   std::vector<Flow> flows = read_csv(file, boundaries, options, num_threads);
+   if (!hashed) hash = content_hash(file, boundaries, num_threads);
+   if (save_cache(cache_name, key, hash, file, flows)) {
+      log << "Saved flows to workload cache " << cache_name << std::endl;
+      evict_caches(filename, log);
+   } else {
+      log << "Warning: could not write workload cache " << cache_name << std::endl;
+   }
+   return flows;
+}
+
+namespace {
+
+//A workload file read by a FlowStream. Pages of the file that have been read are given back every RELEASE_SIZE bytes,
+//so that they do not add to the resident memory.
+struct FileRecords : public RecordSource {
+   static const size_t RELEASE_SIZE = 64 << 20;
+
+   MappedFile file;
+   std::ostream *errors;
+   bool binary;
+   const char *pos;      //next line, for CSV
+   BinaryColumns columns;
+   size_t index;         //next flow, for binary
+   size_t released = 0;  //CSV bytes, or binary flows, given back so far
+
+   bool next (WorkloadRecord &record) override {
+      if (binary) {
+         if (index == columns.num_flows) return false;
+         record = columns.record(index++);
+         if ((index - released) * sizeof(double) >= RELEASE_SIZE) {
+            release(columns.flow_ids, released, index, sizeof(int32_t));
+            release(columns.sources, released, index, sizeof(int32_t));
+            release(columns.dests, released, index, sizeof(int32_t));
+            release(columns.sizes, released, index, sizeof(int64_t));
+            release(columns.start_times, released, index, sizeof(double));
+            released = index;
+         }
+         return true;
+      }
+      if (!next_record(pos, file.data + file.size, record, *errors)) return false;
+      size_t read = pos - file.data;
+      if (read - released >= RELEASE_SIZE) {
+         release(file.data, released, read, 1);
+         released = read;
+      }
+      return true;
+   }
+
+   //Gives back the whole pages among elements [first, last) of column.
+   void release (const void *column, size_t first, size_t last, size_t element_size) {
+      const size_t page = sysconf(_SC_PAGESIZE);
+      uintptr_t begin = ((uintptr_t)column + first * element_size + page - 1) / page * page;
+      uintptr_t end = ((uintptr_t)column + last * element_size) / page * page;
+      if (end > begin) madvise((void *)begin, end - begin, MADV_DONTNEED);
+   }
+};
+
+}
+
+FlowStream::FlowStream (const std::string &filename, const WorkloadOptions &options)
+      : options(options), num_read(0), has_next(false) {
+   auto file_records = std::make_unique<FileRecords>();
+   open_or_exit(file_records->file, filename, *options.errors);
+   file_records->errors = options.errors;
+   file_records->binary = is_binary_workload(file_records->file);
+   if (file_records->binary) {
+      file_records->columns = binary_columns(file_records->file, filename, *options.errors);
+      file_records->index = 0;
+   } else {
+      file_records->pos = file_records->file.data;
+   }
+   source = std::move(file_records);
+   advance();
+}
+
+FlowStream::FlowStream (std::unique_ptr<RecordSource> source, const WorkloadOptions &options)
+      : source(std::move(source)), options(options), num_read(0), has_next(false) {
+   advance();
+}
+
+FlowStream::~FlowStream () = default;
+
+Flow FlowStream::take () {
+   Flow flow = next;
+   advance();
+   return flow;
+}
+
+void FlowStream::advance () {
+   int last_start_tick = has_next ? next.start_tick : 0;
+   has_next = false;
+   if (num_read == options.max_flows) return;
+   WorkloadRecord record;
+   while (source->next(record)) {
+      RecordOutcome outcome = make_flow(record, options, next);
+      if (outcome == FLOW_SKIPPED) continue;
+      if (outcome == FLOW_STOPS_READING) return;
+      if (next.start_tick < last_start_tick) {
+         exit_with_error(*options.errors, "streaming flows needs a workload sorted by start time, but flow "
+                                          + std::to_string(next.flow_id) + " starts before the flow read before it");
+      }
+      has_next = true;
+      num_read++;
+      return;
+   }
+}
+
+void convert_workload (const std::string &csv_filename, const std::string &binary_filename, int num_threads,
+                       std::ostream &log, std::ostream &errors) {
+   MappedFile file;
+   open_or_exit(file, csv_filename, errors);
+   if (is_binary_workload(file)) exit_with_error(errors, csv_filename + " is already a binary workload");
+
+   std::vector<size_t> boundaries = chunk_boundaries(file.data, file.size);
+   int num_chunks = boundaries.size() - 1;
+   std::vector<std::vector<WorkloadRecord>> chunk_records(num_chunks);
+   parallel_for_chunks(0, num_chunks, std::max(1, num_threads), [&](int chunk) {
+      parse_lines(file.data + boundaries[chunk], file.data + boundaries[chunk+1], errors,
+                  [&](const WorkloadRecord &record) {
+         chunk_records[chunk].push_back(record);
+         return true;
+      });
+   });
+
+   //Like the simulator, stop at the first record that stops reading.
+   std::vector<WorkloadRecord> records;
+   for (auto &chunk : chunk_records) {
+      auto stop = std::find_if(chunk.begin(), chunk.end(), stops_reading);
+      records.insert(records.end(), chunk.begin(), stop);
+      if (stop != chunk.end()) break;
+      std::vector<WorkloadRecord>().swap(chunk);
+   }
+   std::stable_sort(records.begin(), records.end(), [](const WorkloadRecord &a, const WorkloadRecord &b) {
+      return a.start_time < b.start_time;
+   });
+
+   BinaryHeader header;
+   memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+   header.num_flows = records.size();
+   BinaryLayout layout = binary_layout(header.num_flows);
+   std::vector<char> contents(layout.end, 0);
+   memcpy(contents.data(), &header, sizeof(header));
+   for (size_t i = 0; i < records.size(); i++) {
+      const WorkloadRecord &record = records[i];
+      int32_t flow_id = record.flow_id, source = record.source, dest = record.dest;
+      int64_t size = record.size;
+      memcpy(&contents[layout.flow_id + i * sizeof(int32_t)], &flow_id, sizeof(flow_id));
+      memcpy(&contents[layout.source + i * sizeof(int32_t)], &source, sizeof(source));
+      memcpy(&contents[layout.dest + i * sizeof(int32_t)], &dest, sizeof(dest));
+      memcpy(&contents[layout.size + i * sizeof(int64_t)], &size, sizeof(size));
+      memcpy(&contents[layout.start_time + i * sizeof(double)], &record.start_time, sizeof(double));
+   }
+
+   std::ofstream out(binary_filename, std::ios::binary);
+   out.write(contents.data(), contents.size());
+   if (!out.good()) exit_with_error(errors, "could not write file " + binary_filename);
+   log << "Converted " << records.size() << " flows from " << csv_filename << " to " << binary_filename << std::endl;
+}
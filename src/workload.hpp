@@ -0,0 +1,95 @@
+#ifndef __WORKLOAD_H
+#define __WORKLOAD_H
+
+#include <climits>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "flow.hpp"
+
+//How the lines of a workload file are turned into flows.
+typedef struct {
+   int max_flows;                               //flows to read at most
+   long min_flow_size;                          //bytes, smaller flows are skipped
+   long max_flow_size;                          //bytes, larger flows are skipped
+   double flow_size_multiplier;
+   double load_factor;                          //start times are divided by this
+   int payload_length;                          //bytes per frame
+   double slot_length;                          //seconds per tick
+   const std::vector<int> *node_of_id;          //node ID for each ID in the file
+   const std::vector<int> *quantization_levels; //sorted, ending with INT_MAX
+   std::ostream *errors;                        //where a bad workload is reported before exiting
+} WorkloadOptions;
+
+typedef enum {WORKLOAD_CACHE_OFF, WORKLOAD_CACHE_ON, WORKLOAD_CACHE_TRUST_MTIME} WorkloadCache;
+
+//Reads a workload file, either a CSV file with one flow per line (flow_id,source,dest,size_bytes,start_time_seconds)
+//or a binary workload written by convert_workload.
+//Reading stops at max_flows flows or at the first flow with a negative start time (even one that would be skipped),
+//and flows outside [min_flow_size, max_flow_size] are skipped.
+//A CSV file is mapped into memory and parsed in chunks by num_threads threads. The flows are returned in file order,
+//stably sorted by start tick, so that each node's flows come out in the order in which they start.
+//Unless cache is WORKLOAD_CACHE_OFF, the flows read from a CSV file are saved next to it in one cache per set of
+//options, along with a hash of the file's contents, and later reads with the same options load them from there instead
+//of parsing if the file still has that hash. With WORKLOAD_CACHE_TRUST_MTIME, a file that still has the size and
+//modification time it had when the cache was written is not hashed again. Only the MAX_WORKLOAD_CACHES (4) most
+//recently used caches of a file are kept, and older ones are deleted when a new one is saved.
+//What happened is reported on log.
+//Exits with an error message on options.errors if the file cannot be read or a line is malformed.
+std::vector<Flow> read_workload (const std::string &filename, const WorkloadOptions &options, int num_threads,
+                                 WorkloadCache cache, std::ostream &log);
+
+//One flow as it appears in a workload file: source and dest index WorkloadOptions::node_of_id.
+typedef struct {
+   int flow_id;
+   int source;
+   int dest;
+   long size;         //bytes
+   double start_time; //seconds
+} WorkloadRecord;
+
+//Where a FlowStream gets its flows from.
+class RecordSource {
+   public:
+   virtual ~RecordSource () {}
+
+   //Returns false once there are no more records.
+   virtual bool next (WorkloadRecord &record) = 0;
+};
+
+//Reads the flows of a workload file one at a time, with the same options and in the same order as read_workload, so
+//that they can be handed to the nodes as the simulation reaches their start ticks (--stream-flows). The file must be
+//sorted by start time (binary workloads always are).
+//Flows can also come from any other RecordSource, such as a SyntheticWorkload.
+class FlowStream {
+   std::unique_ptr<RecordSource> source;
+   WorkloadOptions options;
+   int num_read;
+   bool has_next;
+   Flow next;
+
+   public:
+   FlowStream (const std::string &filename, const WorkloadOptions &options);
+   FlowStream (std::unique_ptr<RecordSource> source, const WorkloadOptions &options);
+   ~FlowStream ();
+
+   //Start tick of the next flow, or INT_MAX if all flows have been taken.
+   int next_start_tick () const { return has_next ? next.start_tick : INT_MAX; }
+
+   //Must only be called if there is a next flow.
+   Flow take ();
+
+   //Flows read so far, including the next one.
+   int flows_read () const { return num_read; }
+
+   private:
+   void advance ();
+};
+
+//Writes the flows of a CSV workload file (up to the first one that starts before time 0) to a binary workload file,
+//sorted by start time. The binary file holds one column per field, and is mapped straight into memory when read.
+void convert_workload (const std::string &csv_filename, const std::string &binary_filename, int num_threads,
+                       std::ostream &log, std::ostream &errors);
+
+#endif